@@ -29,3 +29,58 @@
 
 // Volume
 #define DEFAULT_VOLUME        20   // 0-100 percentage
+
+// GPT KV cache precision (GPT_KV_F32 / GPT_KV_F16 / GPT_KV_INT8)
+#define GPT_KV_STORAGE        GPT_KV_F16
+
+// Speculative decoding: GPT_SPEC_OFF, GPT_SPEC_NGRAM (drafts from history
+// + built-in songs) or GPT_SPEC_EARLY_EXIT (drafts from the first
+// GPT_DRAFT_LAYERS layers). Off until measured on the device.
+#define GPT_SPEC_MODE         GPT_SPEC_OFF
+#define GPT_DRAFT_LAYERS      2
+
+// Quantize each token's matmul inputs to int8 so projections and the MLP
+// run as int8 x int8 -> int32 dot products (W8A8). The LM head keeps
+// fp32 inputs.
+#define GPT_W8A8              1
+
+// Raw flash partition (partitions.csv) the model runs from in place. Write
+// it with `esptool.py write_flash 0x500000 data/model.bin` (or an INT4 file
+// from gpt_quantize); when it holds no model, /model.bin is loaded from
+// LittleFS into PSRAM instead.
+#define GPT_MODEL_PARTITION   "model"
+
+// Keep prompt prefix snapshots (see mini_gpt.h) in LittleFS across
+// reboots. Off by default: an fp16 snapshot of a long prompt is over 1 MB
+// and LittleFS may also hold /model.bin.
+#define GPT_PREFIX_PERSIST    0
+#define GPT_PREFIX_FILE       "/prefix.bin"
+
+// Generations that run at once, each in its own GPTSession on the shared
+// weights (own KV cache, ~1.6 MB of PSRAM with fp16, plus ~25 KB of SRAM
+// scratch and up to GPT_PREFIX_MAX_BYTES of snapshots). Requests beyond
+// that wait in line, up to GPT_GEN_QUEUE in all, one per client.
+#define GPT_SESSIONS          1
+#define GPT_GEN_QUEUE         4
+
+// With several sessions, decode the requests waiting together: one worker
+// runs them as a batch (gpt_generate_batch), reading each weight matrix
+// once per token for all of them. A lone request still decodes on its
+// own with speculative decoding. 0 runs one worker per session instead.
+#define GPT_BATCH_DECODE      1
+
+// Generate-ahead pool: finished, parse-checked melodies kept in PSRAM so
+// a plain "gen" plays one at once (gen:seed:<n> still generates). The
+// worker refills it on core 0 once no request has been in flight for
+// GPT_POOL_IDLE_MS and drops a refill as soon as a request arrives.
+// Entries are a few KB each; 0 turns the pool off.
+#define GPT_POOL_SIZE         2
+#define GPT_POOL_IDLE_MS      1000
+// Keep pooled melodies in LittleFS (one file per slot, %d = slot) so the
+// first press after a reboot is instant too
+#define GPT_POOL_PERSIST      0
+#define GPT_POOL_FILE         "/pool%d.mml"
+
+// Split GPT matmuls and attention heads with a helper task on core 1
+// (generation runs on core 0). Paused while any buzzer is playing.
+#define GPT_DUAL_CORE         1
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+
+// N-gram draft proposals for speculative decoding. Drafts continue the
+// longest earlier match for the context's last tokens in the recently
+// generated text, or failing that the latest occurrence of its last
+// GPT_DRAFT_NGRAM tokens in an index over a tokenized corpus
+// (the songs.h MML strings on the device). gpt_generate verifies them in
+// one batched forward pass.
+
+struct GPTModel;
+
+// Draft tokens verified per forward pass (pass size is 1 + this)
+#define GPT_DRAFT_MAX 4
+// Context tokens a match needs before it proposes drafts
+#define GPT_DRAFT_NGRAM 3
+// Longest history match measured (longer ones tie)
+#define GPT_DRAFT_MATCH_MAX 32
+// Recent tokens searched for a history match, bounding the per-token cost
+#define GPT_DRAFT_HISTORY 128
+// Corpus index buckets (log2)
+#define GPT_DRAFT_TABLE_BITS 16
+
+struct GPTDraft {
+    uint16_t* corpus;      // [corpus_len] token ids in PSRAM, songs separated by 0xFFFF
+    uint32_t  corpus_len;
+    uint32_t* table;       // [1 << GPT_DRAFT_TABLE_BITS] corpus position following an n-gram (0 = empty)
+};
+
+struct GPTDraftStats {
+    uint32_t  proposed;    // draft tokens sent to verification
+    uint32_t  accepted;    // draft tokens kept
+    uint32_t  passes;      // decode forward passes
+};
+
+// Tokenize texts with the model's vocabulary and index every n-gram.
+// Replaces any previous corpus. Returns false if PSRAM runs out.
+bool gpt_draft_build(GPTModel* model, const char* const* texts, int count);
+void gpt_draft_free(GPTDraft* draft);
+
+// Propose up to max_out tokens to follow ctx[0..ctx_len). Returns the
+// number written to out (0 when nothing matches).
+int gpt_draft_propose(const GPTDraft* draft, const int* ctx, int ctx_len, int* out, int max_out);
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+
+// Inner-loop kernels of the GPT forward pass. Kept out of mini_gpt.cpp
+// so the host benchmarks can time them at the real model shapes.
+
+// out[n] = x[n] / rms(x) * gamma[n]
+void rmsnorm(float* out, const float* x, const float* gamma, int n);
+
+// out[rows] = weight_int8[rows x cols] @ in[cols], then scale per row
+void matmul_int8(float* out, const float* in, const int8_t* weight,
+                 const float* scales, int rows, int cols);
+
+// matmul_int8 for n inputs at once: in is [n][cols], out is [n][rows].
+// Weights are streamed once for the whole batch.
+void matmul_int8_batch(float* out, const float* in, const int8_t* weight,
+                       const float* scales, int rows, int cols, int n);
+
+// matmul_int8_batch for weight rows [r_begin, r_end) only (same in/out
+// layout), so one matmul can be split across cores
+void matmul_int8_rows(float* out, const float* in, const int8_t* weight,
+                      const float* scales, int rows, int cols, int n, int r_begin, int r_end);
+
+// W8A8 variant of matmul_int8_rows: inputs are int8 rows in_q [n][cols]
+// with one scale per row (quantize_rows_q8). Dot products accumulate in
+// int32; weight and input scales are applied once per output.
+void matmul_w8a8_rows(float* out, const int8_t* in_q, const float* in_scales,
+                      const int8_t* weight, const float* scales,
+                      int rows, int cols, int n, int r_begin, int r_end);
+
+// n rows of cols floats to int8, one symmetric scale (max|x| / 127) per row
+void quantize_rows_q8(int8_t* dst, float* scales, const float* src, int cols, int n);
+
+// ---------- 4-bit weights (MGPT quant_type 2) ----------
+// Row r of a [rows x cols] int4 matrix is cols / 2 bytes at r * cols / 2,
+// with fp16 scales [rows][cols / group]; see dot_q4_f32 in gpt_simd.h for
+// the nibble order and the limits on group.
+
+// matmul_int8_rows for an int4 matrix
+void matmul_q4_rows(float* out, const float* in, const uint8_t* weight, const uint16_t* scales,
+                    int group, int rows, int cols, int n, int r_begin, int r_end);
+
+// matmul_w8a8_rows for an int4 matrix
+void matmul_q4_w8a8_rows(float* out, const int8_t* in_q, const float* in_scales,
+                         const uint8_t* weight, const uint16_t* scales,
+                         int group, int rows, int cols, int n, int r_begin, int r_end);
+
+// In-place softmax over x[n]
+void softmax(float* x, int n);
+
+// Positions per K/V tile when attention stages the cache through SRAM
+#define GPT_ATT_TILE 32
+
+// Causal attention for one head over positions [0, pos].
+// k/v point at position 0 of this head; consecutive positions are `stride`
+// elements apart (head_dim for the head-major cache). att is [pos + 1]
+// scratch, out is [head_dim]. If tile is non-null (GPT_ATT_TILE * head_dim
+// elements of the cache's type, ideally internal SRAM), K/V rows are
+// copied there one tile at a time and read back densely.
+void attention_head(float* out, const float* q, const float* k, const float* v,
+                    float* att, int pos, int head_dim, int stride, void* tile = nullptr);
+
+// ---------- reduced-precision KV cache ----------
+
+// IEEE half <-> float. Rounds to nearest even and saturates at +-65504
+// instead of producing Inf, so cached values always convert back finite.
+uint16_t fp32_to_fp16(float f);
+float fp16_to_fp32(uint16_t h);
+
+// Store n floats as fp16
+void kv_store_f16(uint16_t* dst, const float* src, int n);
+
+// Store n floats as int8 with one symmetric scale (max|x| / 127)
+void kv_store_q8(int8_t* dst, float* scale, const float* src, int n);
+
+// attention_head over an fp16 cache, converting K/V on the fly
+void attention_head_f16(float* out, const float* q, const uint16_t* k, const uint16_t* v,
+                        float* att, int pos, int head_dim, int stride, void* tile = nullptr);
+
+// attention_head over an int8 cache. k_scale/v_scale point at this head's
+// scale for position 0; consecutive positions are scale_stride apart.
+void attention_head_q8(float* out, const float* q,
+                       const int8_t* k, const float* k_scale,
+                       const int8_t* v, const float* v_scale,
+                       float* att, int pos, int head_dim, int stride, int scale_stride,
+                       void* tile = nullptr);
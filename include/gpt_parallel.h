@@ -0,0 +1,36 @@
+#pragma once
+
+// Two-worker fork/join for the forward pass. The calling task runs part 0
+// of each job while a helper task pinned to the other core runs part 1;
+// gpt_parallel_run returns once both are done. Jobs split their work by
+// output rows or heads, so results match single-core bit for bit. On the
+// device the handoff uses FreeRTOS task notifications, on the host a
+// std::thread. Any number of tasks may call gpt_parallel_run at once (one
+// per GPTSession); while the helper is busy with one job, the others run
+// on their callers alone.
+
+// Job body: handle share `part` of `parts` (parts is 1 when running alone)
+typedef void (*GPTParallelFn)(void* ctx, int part, int parts);
+
+#define GPT_PARALLEL_WORKERS 2
+
+// Start the helper on the given core (ignored on the host). Returns false
+// if the task could not be created; jobs then run on the caller alone.
+bool gpt_parallel_start(int core);
+void gpt_parallel_stop();
+
+// Run jobs on the caller alone while disabled (e.g. during playback, so
+// the helper stays off the core that times the buzzers). Takes effect at
+// the next job.
+void gpt_parallel_set_enabled(bool enabled);
+
+// Workers the next job will use: 1 or GPT_PARALLEL_WORKERS
+int gpt_parallel_workers();
+
+void gpt_parallel_run(GPTParallelFn fn, void* ctx);
+
+// [*begin, *end) of n items for share part of parts
+inline void gpt_parallel_range(int n, int part, int parts, int* begin, int* end) {
+    *begin = n * part / parts;
+    *end = n * (part + 1) / parts;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+
+// Dot-product kernels under the gpt_kernels matmuls, one implementation per
+// target, picked at compile time:
+//   GPT_SIMD_SSE2    x86-64 host build
+//   GPT_SIMD_NEON    ARM host build
+//   GPT_SIMD_PIE     ESP32-S3 vector unit (int8 x int8 only; it has no
+//                    float lanes, so float kernels stay scalar there)
+//   GPT_SIMD_SCALAR  anything else, or forced with -D GPT_SIMD_SCALAR
+// Each kernel has a plain-C _ref twin. Float kernels add in the same fixed
+// order as their reference, so on a given target the results match bit
+// for bit (host builds use -ffp-contract=off so no FMA sneaks into either).
+
+// Float dot products keep GPT_DOT_LANES partial sums: lane l takes the
+// elements c with c % GPT_DOT_LANES == l, up to n rounded down to a multiple
+// of GPT_DOT_LANES. Lanes combine as ((l0 + l4) + (l2 + l6)) +
+// ((l1 + l5) + (l3 + l7)), then the remaining elements add in order.
+#define GPT_DOT_LANES 8
+
+// sum(w[c] * x[c]) for c < n
+float dot_i8_f32(const int8_t* w, const float* x, int n);
+float dot_i8_f32_ref(const int8_t* w, const float* x, int n);
+
+// dot_i8_f32 of one weight row against four inputs, out[i] for x[i]
+void dot4_i8_f32(const int8_t* w, const float* const* x, int n, float* out);
+void dot4_i8_f32_ref(const int8_t* w, const float* const* x, int n, float* out);
+
+// Exact sum(a[c] * b[c]) for c < n; the sum must fit in int32. The PIE
+// path needs both pointers 16-byte aligned and n a multiple of 16, and
+// falls back to the reference otherwise.
+int32_t dot_i8_i8(const int8_t* a, const int8_t* b, int n);
+int32_t dot_i8_i8_ref(const int8_t* a, const int8_t* b, int n);
+
+// dot_i8_i8 against its reference over aligned and unaligned inputs of a
+// few lengths; false on any difference. The host benches never build the
+// PIE path, so the firmware runs this before enabling W8A8.
+bool gpt_simd_check();
+
+// ---------- 4-bit weights ----------
+// w is a row of n two's-complement nibbles, byte c holding elements 2c
+// (low nibble) and 2c + 1 (high nibble). Each run of `group` elements has
+// an fp16 scale in scales[]. group must be a multiple of 16, at most
+// GPT_Q4_GROUP_MAX, and divide n.
+#define GPT_Q4_GROUP_MAX 128
+
+// sum over groups of scale * dot(group). Each group keeps the
+// GPT_DOT_LANES lane sums of dot_i8_f32; those are scaled and added into
+// running lanes, which combine once at the end in the same order.
+float dot_q4_f32(const uint8_t* w, const uint16_t* scales, int group, const float* x, int n);
+float dot_q4_f32_ref(const uint8_t* w, const uint16_t* scales, int group, const float* x, int n);
+
+// sum over groups, in order, of scale * exact int32 dot(group)
+float dot_q4_i8(const uint8_t* w, const uint16_t* scales, int group, const int8_t* x, int n);
+float dot_q4_i8_ref(const uint8_t* w, const uint16_t* scales, int group, const int8_t* x, int n);
+
+// The compiled-in implementation: "sse2", "neon", "pie" or "scalar"
+const char* gpt_simd_name();
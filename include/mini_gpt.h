@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdint>
 #include <cstddef>
+#include "gpt_draft.h"
+#include "gpt_parallel.h"
 
 struct GPTConfig {
     uint16_t n_embd;
@@ -12,7 +14,7 @@ struct GPTConfig {
 };
 
 struct GPTWeights {
-    // Pointers into PSRAM-loaded file (zero-copy)
+    // Pointers into the loaded or mapped file (zero-copy)
     const float*   tok_emb;      // [vocab_size * n_embd]
     const float*   pos_emb;      // [block_size * n_embd]
     struct Layer {
@@ -35,43 +37,263 @@ struct GPTWeights {
     const float*   final_norm_gamma;
     const int8_t*  lm_head_w;   // [vocab_size * n_embd]
     const float*   lm_head_s;   // [vocab_size]
+    // MGPT quant_type: 1 = int8 with an fp32 scale per row; 2 = int4 with
+    // an fp16 scale per group_size columns, where the *_w pointers address
+    // packed nibbles and the *_s pointers uint16_t scales (gpt_kernels.h)
+    uint8_t quant_type;
+    uint8_t group_size;
+};
+
+// Leading positions pinned in the KV cache once generation runs past
+// block_size (attention sinks); the remaining slots form a ring buffer.
+#define GPT_KV_SINK_TOKENS 4
+
+// KV cache storage precision, chosen per session
+enum GPTKVType : uint8_t {
+    GPT_KV_F32  = 0,  // 4 bytes per element
+    GPT_KV_F16  = 1,  // 2 bytes per element
+    GPT_KV_INT8 = 2,  // 1 byte per element + fp32 scale per head per position
+};
+
+// Speculative decoding in gpt_generate. Drafts are verified by rejection
+// sampling, so the output distribution is unchanged.
+enum GPTSpecMode : uint8_t {
+    GPT_SPEC_OFF        = 0,
+    GPT_SPEC_NGRAM      = 1,  // drafts from gpt_draft (history + corpus n-grams)
+    GPT_SPEC_EARLY_EXIT = 2,  // drafts from the first draft_layers layers + LM head
 };
 
 struct KVCache {
-    float* k;  // [n_layer * block_size * n_embd] in PSRAM
-    float* v;  // same
+    GPTKVType type;
+    void*  k;        // [n_layer][n_head][block_size][head_dim] in PSRAM, indexed by slot
+    void*  v;        // same
+    float* k_scale;  // [n_layer][n_head][block_size] (INT8 only, tail of k's allocation)
+    float* v_scale;  // same, tail of v's allocation
 };
 
+// Largest top-k the sampler supports (scratch is sized for this)
+#define GPT_MAX_TOP_K 64
+
+struct GPTCandidate {
+    float logit;
+    int   id;
+};
+
+// Prompt tokens processed per batched forward pass during prefill
+#define GPT_PREFILL_CHUNK 8
+static_assert(GPT_DRAFT_MAX + 1 <= GPT_PREFILL_CHUNK, "draft verification must fit a chunk");
+
 struct GPTBuffers {
-    // Scratch in internal SRAM for speed
-    float* x;        // [n_embd]
-    float* xb;       // [n_embd]
-    float* q;        // [n_embd]
-    float* att;      // [n_head * block_size]
-    float* mlp_buf;  // [4 * n_embd]
-    float* logits;   // [vocab_size]
+    // One session's scratch in one of two row layouts: a single row in
+    // internal SRAM for one-token decode, or R = rows rows in PSRAM for
+    // prefill chunks (C = GPT_PREFILL_CHUNK), drafts and batches. The
+    // buffers without R are shared by both.
+    int    rows;     // R: 1 or C
+    float* x;        // [R * n_embd]
+    float* xb;       // [R * n_embd]
+    float* q;        // [R * n_embd]
+    float* att;      // [n_head * block_size] (SRAM)
+    float* mlp_buf;  // [R * 4 * n_embd]
+    float* logits;   // [1 or GPT_DRAFT_MAX + 1 rows][vocab_size], one row per verified position
+    float* kv;       // [2 * R * n_embd] the rows' K then V before the cache store
+    int8_t* xq;      // [R * 4 * n_embd] int8 matmul inputs in W8A8 mode (16-byte aligned)
+    float* xq_scale; // [C] per-row scale of xq (SRAM)
+    void*  att_tile; // [GPT_PARALLEL_WORKERS][GPT_ATT_TILE * head_dim] floats, K/V staging for attention (SRAM)
+    GPTCandidate* cand;  // [GPT_MAX_TOP_K] top-k sampling scratch (SRAM)
+    GPTCandidate* draft_cand;  // [GPT_DRAFT_MAX * GPT_MAX_TOP_K] early-exit draft distributions (PSRAM)
+    uint8_t* allowed;    // grammar masks, rows as logits
+    uint8_t* kv_save;    // [GPT_DRAFT_MAX] ring slots overwritten by drafts (PSRAM)
+};
+
+// Special token ids
+#define GPT_TOKEN_PAD 0
+#define GPT_TOKEN_BOS 1
+#define GPT_TOKEN_EOS 2
+
+// Longest token the prompt encoder will match (longer vocab entries are
+// never produced by it)
+#define GPT_TOKEN_MATCH_MAX 16
+
+// Prefix trie node over the vocabulary, first-child / next-sibling linked
+struct GPTTrieNode {
+    uint16_t child;    // first child node (0 = none; the root is never a child)
+    uint16_t sibling;  // next sibling node (0 = none)
+    int16_t  token;    // token id ending at this node, or -1
+    char     ch;
 };
 
 struct TokenMap {
-    char** tokens;    // [vocab_size] array of C strings
+    const char** tokens; // [vocab_size] C strings, packed in the SRAM arena
+    GPTTrieNode* trie;   // [trie_nodes] in PSRAM, node 0 is the root
+    int trie_nodes;
+};
+
+// PCG32 sampler state; same seed gives the same stream on device and host
+struct GPTRng {
+    uint64_t state;
+};
+
+// Prefix snapshots: gpt_generate keeps the K/V of recent prompts (and the
+// logits after their last token) in PSRAM and resumes a prompt from the
+// longest one it starts with. Least recently used entries are evicted to
+// stay within both limits. A snapshot costs kv_slot_bytes per token (3 KB
+// with an fp16 cache), so 2 MB holds a prompt of about 650 tokens.
+#define GPT_PREFIX_SLOTS     4
+#define GPT_PREFIX_MAX_BYTES (2 * 1024 * 1024)
+
+struct GPTPrefix {
+    uint8_t*  data;       // one PSRAM block holding the three arrays below
+    uint16_t* tokens;     // [n_tokens]
+    float*    logits;     // [vocab_size] after tokens[n_tokens - 1]
+    uint8_t*  kv;         // K/V of positions [0, n_tokens), see kv_prefix_copy
+    size_t    bytes;
+    int       n_tokens;   // 0 = free entry
+    bool      masked;     // logits were computed under the grammar mask
+    bool      w8a8;       // K/V were computed with int8 matmul inputs
+    uint32_t  last_used;
 };
 
-struct MiniGPT {
+struct GPTPrefixCache {
+    GPTPrefix entries[GPT_PREFIX_SLOTS];
+    size_t    bytes;      // PSRAM held by all entries
+    uint32_t  clock;      // LRU counter
+    uint32_t  hits, misses;
+    int       reused;     // prompt tokens the last gpt_generate restored
+    bool      dirty;      // changed since the last gpt_prefix_load/save
+};
+
+// Header and token-map summary of a model file; enough to plan its memory
+struct GPTFileInfo {
+    GPTConfig config;
+    uint8_t   quant_type;
+    uint8_t   group_size;
+    size_t    token_chars;  // total length of the vocabulary strings
+    size_t    weights_offset;  // first weight byte (after the aligned token map)
+};
+
+// Everything gpt_load and gpt_session_init allocate besides the model file
+// comes from arenas: internal SRAM for the hot scratch buffers and tables,
+// PSRAM for the KV cache and the trie. The model owns one pair (token
+// tables, trie), every session another (KV cache, scratch). Each item
+// starts 16-byte aligned.
+enum GPTArena : uint8_t {
+    GPT_ARENA_SRAM  = 0,
+    GPT_ARENA_PSRAM = 1,
+};
+
+struct GPTPlanItem {
+    const char* name;
+    GPTArena    arena;
+    bool        session;  // in the session's arenas rather than the model's
+    size_t      offset;   // within the arena
+    size_t      bytes;
+};
+
+#define GPT_PLAN_ITEMS 28
+
+struct GPTMemoryPlan {
+    GPTPlanItem items[GPT_PLAN_ITEMS];
+    size_t      model_bytes[2];    // indexed by GPTArena
+    size_t      session_bytes[2];  // per session
+};
+
+// Weights and vocabulary, read-only once loaded: any number of sessions
+// can run on one model at the same time.
+struct GPTModel {
     GPTConfig   config;
     GPTWeights  weights;
-    KVCache     cache;
-    GPTBuffers  buffers;
     TokenMap    tokenMap;
-    uint8_t*    fileData;  // Raw file in PSRAM (owns the allocation)
+    uint8_t*    arena[2];  // Token tables and trie laid out by gpt_plan_memory
+    uint8_t*    fileData;  // Raw file: PSRAM copy (owned) or flash mapping
     size_t      fileSize;
-    int         pos;       // Current sequence position
+    bool        fileMapped;  // fileData maps a flash partition (gpt_load_partition)
+    uint32_t    fileMap;     // spi_flash_mmap_handle_t of that mapping
+    GPTDraft    draft;     // Draft corpus index (gpt_draft_build)
+};
+
+// One sequence being generated: KV cache, scratch and sampler state. A
+// session is used by one task at a time; different sessions of the same
+// model may run concurrently.
+struct GPTSession {
+    const GPTModel* model;
+    KVCache     cache;
+    GPTBuffers  buffers;        // the layout in use: one of the two below
+    GPTBuffers  token_buffers;  // one row, SRAM
+    GPTBuffers  chunk_buffers;  // GPT_PREFILL_CHUNK rows, PSRAM
+    uint8_t*    arena[2];  // KV cache and scratch laid out by gpt_plan_memory
+    int         pos;       // Current sequence position (may exceed block_size)
+    GPTRng      rng;       // Sampling PRNG (reseed per request with gpt_seed)
+    bool        grammar;   // Mask tokens parseMML can't use (on after init)
+    GPTSpecMode speculative;  // Draft source (GPT_SPEC_OFF after init)
+    uint8_t     draft_layers; // Early-exit draft depth (2 after init)
+    bool        w8a8;      // Quantize matmul inputs to int8 per token (off after init)
+    GPTDraftStats draft;   // Draft statistics of the last gpt_generate
+    bool        prefix_cache;  // Resume prompts from snapshots (on after init)
+    GPTPrefixCache prefix;
 };
 
 // Callback for streaming: called with each generated token string
 typedef void (*GPTStreamCallback)(const char* token_str, void* user_data);
 
 // API
-bool gpt_load(MiniGPT* model, const char* path);
-void gpt_free(MiniGPT* model);
-char* gpt_generate(MiniGPT* model, const char* prompt, int max_tokens,
-                   float temperature, GPTStreamCallback cb, void* user_data);
+bool gpt_load(GPTModel* model, const char* path);
+// Like gpt_load, but maps the raw data partition `label` (model.bin written
+// at its start) through the flash cache and reads weights from it in place
+// instead of copying them to PSRAM.
+bool gpt_load_partition(GPTModel* model, const char* label);
+// Free the model; its sessions must be freed first
+void gpt_free(GPTModel* model);
+// Allocate a session's KV cache and scratch for a loaded model
+bool gpt_session_init(GPTSession* session, const GPTModel* model, GPTKVType kv_type = GPT_KV_F32);
+void gpt_session_free(GPTSession* session);
+// Validate a model file's header and walk its token map. size may cover
+// only a prefix of the file, as long as it includes the token map.
+bool gpt_read_header(const uint8_t* data, size_t size, GPTFileInfo* info);
+// Byte-exact arena layout gpt_load and gpt_session_init will use for a
+// model; nothing is allocated. token_chars sizes the token strings and trie.
+void gpt_plan_memory(const GPTConfig& cfg, GPTKVType kv_type, size_t token_chars,
+                     GPTMemoryPlan* plan);
+void gpt_plan_print(const GPTMemoryPlan& plan);
+void gpt_seed(GPTSession* session, uint32_t seed);
+// Greedy longest-match tokenization of text into out[max_out]; characters
+// no token starts with are skipped. Returns the number of tokens written.
+int gpt_encode(const GPTModel* model, const char* text, int* out, int max_out);
+// Stops within one layer of *cancel becoming true and returns the text
+// generated so far.
+char* gpt_generate(GPTSession* session, const char* prompt, int max_tokens,
+                   float temperature, GPTStreamCallback cb, void* user_data,
+                   const volatile bool* cancel = nullptr);
+// One sequence of gpt_generate_batch
+struct GPTBatchItem {
+    GPTSession* session;
+    const char* prompt;
+    float       temperature;
+    void*       user_data;        // passed to the stream callback
+    const volatile bool* cancel;  // optional; ends this sequence only
+    char*       output;           // set by gpt_generate_batch (caller must free)
+};
+
+// Sequences per batched decode step (rows of one forward pass)
+#define GPT_BATCH_MAX GPT_PREFILL_CHUNK
+
+// Generate from up to GPT_BATCH_MAX distinct sessions of one model at once.
+// Prompts are prefilled one session at a time; after that every decode
+// step runs the next token of all unfinished sequences as one forward
+// pass, so each weight matrix is read once per step for the whole batch.
+// Each sequence samples at its own temperature like gpt_generate with
+// speculative decoding off: a session seeded the same produces the same
+// text either way. The pass runs in the first session's scratch. Returns
+// false (and generates nothing) if count is out of range or the sessions
+// differ in model or W8A8 mode.
+bool gpt_generate_batch(GPTBatchItem* items, int count, int max_tokens, GPTStreamCallback cb);
+// Teacher-forced scoring: restarts the sequence, runs tokens[0..n) and
+// writes the unmasked logits that follow tokens[i] to
+// logits[i * vocab_size]. For comparing inference modes on fixed text.
+void gpt_score(GPTSession* session, const int* tokens, int n, float* logits);
+// Prefix snapshots (per session): drop them all, or persist them in a
+// LittleFS file. A snapshot only serves the W8A8 mode it was taken in;
+// saving keeps those of the session's mode, and loading ignores a file
+// written for another model file, KV type or W8A8 mode.
+void gpt_prefix_clear(GPTSession* session);
+bool gpt_prefix_save(GPTSession* session, const char* path);
+bool gpt_prefix_load(GPTSession* session, const char* path);
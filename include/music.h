@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+
+// MML / RTTTL parsing into [freq_hz, duration_ms] note arrays.
+// Hardware-independent so the host build can exercise it.
+
+uint16_t noteFreq(uint8_t semitone, uint8_t octave);
+uint16_t parseRTTTL(const char* rtttl, uint16_t out[][2], uint16_t maxNotes);
+uint16_t parseMML(const char* mml, uint16_t out[][2], uint16_t maxNotes, uint8_t track = 0);
+uint8_t countMMLTracks(const char* mml);
+
+// Incremental MML syntax tracker mirroring parseMML's command set
+// (t/l/o/v with digits, </>, notes with +/#/- then length, '.', '&' ties,
+// ',' between tracks, ';' to end). Used to keep generated text playable.
+enum MMLGrammarState : uint8_t {
+    MML_G_PREFIX,    // matching "MML@" (count = chars matched)
+    MML_G_READY,     // between commands
+    MML_G_NUMBER,    // digits after t/l/o/v (count so far, limit = max)
+    MML_G_NOTE,      // after a note letter; accidental may follow
+    MML_G_LENGTH,    // note/rest length digits (count so far)
+    MML_G_DOT,       // after the dotting '.'
+    MML_G_TIE,       // after '&'; tied note, rest or length may follow
+    MML_G_DONE,      // after ';'
+};
+
+struct MMLGrammar {
+    uint8_t state;   // MMLGrammarState
+    uint8_t count;
+    uint8_t limit;
+};
+
+void mmlGrammarInit(MMLGrammar& g);
+// Advance by one character; returns false (state unchanged) if parseMML
+// would skip or misread it here
+bool mmlGrammarStep(MMLGrammar& g, char c);
+// Advance by a whole string; false if any character is rejected (g is then
+// left at the last accepted character)
+bool mmlGrammarFeed(MMLGrammar& g, const char* s);
+// True if the text so far is a complete MML string (generation may stop)
+bool mmlGrammarCanEnd(const MMLGrammar& g);
@@ -0,0 +1,34 @@
+#pragma once
+#include <Arduino.h>
+#include "config.h"
+
+// Software PWM sample rate driven by the audio timer ISR
+#define SAMPLE_RATE_HZ 40000
+
+struct BuzzerPWM {
+    volatile uint32_t phase;      // 32-bit phase accumulator
+    volatile uint32_t phaseInc;   // Phase increment (determines frequency)
+    volatile uint16_t dutyOn;     // PWM duty threshold (0-512)
+};
+extern volatile BuzzerPWM buzzerPWM[NUM_BUZZERS];
+extern uint8_t volumePercent;
+
+struct MelodyPlayer {
+    const uint16_t (*melody)[2];
+    uint16_t length;
+    uint16_t noteIndex;
+    unsigned long noteStartedAt;
+    uint16_t gapDuration;
+    bool playing;
+    bool inGap;
+    bool inLoopPause;
+    uint8_t buzzerPin;
+    uint8_t ledcChannel;
+    int8_t octaveShift;
+};
+
+// Note sequencing against millis(); only touches buzzerPWM state, so it
+// runs unchanged on the host build.
+void setupNote(MelodyPlayer& p);
+void advanceNote(MelodyPlayer& p);
+void updatePlayer(MelodyPlayer& p);
@@ -0,0 +1,121 @@
+#include "gpt_draft.h"
+#include "mini_gpt.h"
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+static const uint16_t DRAFT_SEP = 0xFFFF;
+
+// FNV-1a over GPT_DRAFT_NGRAM token ids, folded to the table size
+template <typename T>
+static inline uint32_t ngram_hash(const T* tokens) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < GPT_DRAFT_NGRAM; i++) {
+        h = (h ^ (uint32_t)tokens[i]) * 16777619u;
+    }
+    return h >> (32 - GPT_DRAFT_TABLE_BITS);
+}
+
+void gpt_draft_free(GPTDraft* draft) {
+    if (draft->corpus) heap_caps_free(draft->corpus);
+    if (draft->table) heap_caps_free(draft->table);
+    draft->corpus = nullptr;
+    draft->table = nullptr;
+    draft->corpus_len = 0;
+}
+
+bool gpt_draft_build(GPTModel* model, const char* const* texts, int count) {
+    GPTDraft* draft = &model->draft;
+    gpt_draft_free(draft);
+
+    // A token covers at least one character, so characters bound tokens
+    size_t total = 0, longest = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(texts[i]);
+        total += len + 1;
+        if (len > longest) longest = len;
+    }
+
+    int* scratch = (int*)heap_caps_malloc((longest + 1) * sizeof(int), MALLOC_CAP_SPIRAM);
+    draft->corpus = (uint16_t*)heap_caps_malloc(total * sizeof(uint16_t), MALLOC_CAP_SPIRAM);
+    draft->table = (uint32_t*)heap_caps_malloc(sizeof(uint32_t) << GPT_DRAFT_TABLE_BITS,
+                                               MALLOC_CAP_SPIRAM);
+    if (!scratch || !draft->corpus || !draft->table) {
+        Serial.println("[GPT] ERROR: Failed to allocate draft index");
+        if (scratch) heap_caps_free(scratch);
+        gpt_draft_free(draft);
+        return false;
+    }
+    memset(draft->table, 0, sizeof(uint32_t) << GPT_DRAFT_TABLE_BITS);
+
+    uint32_t n = 0;
+    for (int i = 0; i < count; i++) {
+        int len = gpt_encode(model, texts[i], scratch, (int)longest);
+        for (int t = 0; t < len; t++) draft->corpus[n++] = (uint16_t)scratch[t];
+        draft->corpus[n++] = DRAFT_SEP;
+    }
+    draft->corpus_len = n;
+    heap_caps_free(scratch);
+
+    // Index the position after every n-gram that has a successor within
+    // the same song; later occurrences replace earlier ones
+    uint32_t indexed = 0;
+    for (uint32_t pos = GPT_DRAFT_NGRAM; pos < n; pos++) {
+        if (draft->corpus[pos] == DRAFT_SEP) continue;
+        const uint16_t* key = draft->corpus + pos - GPT_DRAFT_NGRAM;
+        bool crosses = false;
+        for (int i = 0; i < GPT_DRAFT_NGRAM; i++) crosses |= key[i] == DRAFT_SEP;
+        if (crosses) continue;
+        draft->table[ngram_hash(key)] = pos;
+        indexed++;
+    }
+
+    Serial.printf("[GPT] Draft index: %d texts, %u tokens, %u n-grams\n", count, n, indexed);
+    return true;
+}
+
+// Continuation of the longest earlier match (most recent on ties) for
+// ctx's tail within its last GPT_DRAFT_HISTORY tokens, if at least
+// GPT_DRAFT_NGRAM tokens long
+static int history_match(const int* ctx, int ctx_len, int* out, int max_out) {
+    int best = 0, best_end = 0;
+    const int* tail = ctx + ctx_len - 1;
+    int oldest = ctx_len > GPT_DRAFT_HISTORY ? ctx_len - GPT_DRAFT_HISTORY : 1;
+    for (int end = ctx_len - 1; end >= oldest; end--) {
+        int m = 0;
+        while (m < end && m < GPT_DRAFT_MATCH_MAX && ctx[end - 1 - m] == tail[-m]) m++;
+        if (m > best) {
+            best = m;
+            best_end = end;
+        }
+    }
+    if (best < GPT_DRAFT_NGRAM) return 0;
+    int k = 0;
+    for (int from = best_end; k < max_out && from < ctx_len; from++) out[k++] = ctx[from];
+    return k;
+}
+
+// Indexed corpus occurrence of ctx's last GPT_DRAFT_NGRAM tokens
+static int corpus_match(const GPTDraft* draft, const int* ctx, int ctx_len, int* out, int max_out) {
+    if (!draft->table || ctx_len < GPT_DRAFT_NGRAM) return 0;
+    const int* key = ctx + ctx_len - GPT_DRAFT_NGRAM;
+    uint32_t pos = draft->table[ngram_hash(key)];
+    if (pos == 0) return 0;
+
+    // Buckets are shared; confirm the n-gram really matches
+    for (int i = 0; i < GPT_DRAFT_NGRAM; i++) {
+        if (draft->corpus[pos - GPT_DRAFT_NGRAM + i] != key[i]) return 0;
+    }
+    int k = 0;
+    for (; k < max_out && pos < draft->corpus_len && draft->corpus[pos] != DRAFT_SEP; pos++) {
+        out[k++] = draft->corpus[pos];
+    }
+    return k;
+}
+
+int gpt_draft_propose(const GPTDraft* draft, const int* ctx, int ctx_len, int* out, int max_out) {
+    if (max_out <= 0) return 0;
+    int k = history_match(ctx, ctx_len, out, max_out);
+    if (k == 0) k = corpus_match(draft, ctx, ctx_len, out, max_out);
+    return k;
+}
@@ -0,0 +1,322 @@
+#include "gpt_kernels.h"
+#include "gpt_simd.h"
+#include <cmath>
+#include <cstring>
+
+// RMS normalization
+void rmsnorm(float* out, const float* x, const float* gamma, int n) {
+    float ss = 0.0f;
+    for (int i = 0; i < n; i++) {
+        ss += x[i] * x[i];
+    }
+    ss = ss / n + 1e-5f;
+    ss = 1.0f / sqrtf(ss);
+    for (int i = 0; i < n; i++) {
+        out[i] = x[i] * ss * gamma[i];
+    }
+}
+
+// INT8 matrix-vector multiply with dequantization
+// out[rows] = weight_int8[rows x cols] @ in[cols], then scale per row
+void matmul_int8(float* out, const float* in, const int8_t* weight,
+                        const float* scales, int rows, int cols) {
+    for (int r = 0; r < rows; r++) {
+        out[r] = dot_i8_f32(weight + r * cols, in, cols) * scales[r];
+    }
+}
+
+// Batched matmul_int8 over n input rows: out[i] = W @ in[i] for i < n.
+// Each weight row is fetched once and dotted against every input while it
+// is hot in cache, four inputs at a time. dot4_i8_f32 adds in the same
+// order as dot_i8_f32, so results match the single-token path bit for bit.
+void matmul_int8_batch(float* out, const float* in, const int8_t* weight,
+                       const float* scales, int rows, int cols, int n) {
+    matmul_int8_rows(out, in, weight, scales, rows, cols, n, 0, rows);
+}
+
+void matmul_int8_rows(float* out, const float* in, const int8_t* weight,
+                      const float* scales, int rows, int cols, int n, int r_begin, int r_end) {
+    if (n == 1) {
+        matmul_int8(out + r_begin, in, weight + (size_t)r_begin * cols, scales + r_begin,
+                    r_end - r_begin, cols);
+        return;
+    }
+    for (int r = r_begin; r < r_end; r++) {
+        const int8_t* row_ptr = weight + r * cols;
+        int i = 0;
+        for (; i + 3 < n; i += 4) {
+            const float* x[4] = {in + (i + 0) * cols, in + (i + 1) * cols,
+                                 in + (i + 2) * cols, in + (i + 3) * cols};
+            float s[4];
+            dot4_i8_f32(row_ptr, x, cols, s);
+            for (int j = 0; j < 4; j++) {
+                out[(i + j) * rows + r] = s[j] * scales[r];
+            }
+        }
+        for (; i < n; i++) {
+            out[i * rows + r] = dot_i8_f32(row_ptr, in + i * cols, cols) * scales[r];
+        }
+    }
+}
+
+void matmul_w8a8_rows(float* out, const int8_t* in_q, const float* in_scales,
+                      const int8_t* weight, const float* scales,
+                      int rows, int cols, int n, int r_begin, int r_end) {
+    for (int r = r_begin; r < r_end; r++) {
+        const int8_t* row_ptr = weight + r * cols;
+        for (int i = 0; i < n; i++) {
+            int32_t acc = dot_i8_i8(row_ptr, in_q + i * cols, cols);
+            out[i * rows + r] = (float)acc * (scales[r] * in_scales[i]);
+        }
+    }
+}
+
+void quantize_rows_q8(int8_t* dst, float* scales, const float* src, int cols, int n) {
+    for (int i = 0; i < n; i++) {
+        kv_store_q8(dst + i * cols, &scales[i], src + i * cols, cols);
+    }
+}
+
+void matmul_q4_rows(float* out, const float* in, const uint8_t* weight, const uint16_t* scales,
+                    int group, int rows, int cols, int n, int r_begin, int r_end) {
+    int groups = cols / group;
+    for (int r = r_begin; r < r_end; r++) {
+        const uint8_t* row_ptr = weight + (size_t)r * cols / 2;
+        for (int i = 0; i < n; i++) {
+            out[i * rows + r] = dot_q4_f32(row_ptr, scales + r * groups, group, in + i * cols, cols);
+        }
+    }
+}
+
+void matmul_q4_w8a8_rows(float* out, const int8_t* in_q, const float* in_scales,
+                         const uint8_t* weight, const uint16_t* scales,
+                         int group, int rows, int cols, int n, int r_begin, int r_end) {
+    int groups = cols / group;
+    for (int r = r_begin; r < r_end; r++) {
+        const uint8_t* row_ptr = weight + (size_t)r * cols / 2;
+        for (int i = 0; i < n; i++) {
+            out[i * rows + r] = dot_q4_i8(row_ptr, scales + r * groups, group, in_q + i * cols, cols) *
+                                in_scales[i];
+        }
+    }
+}
+
+// Softmax
+void softmax(float* x, int n) {
+    float max_val = x[0];
+    for (int i = 1; i < n; i++) {
+        if (x[i] > max_val) max_val = x[i];
+    }
+
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) {
+        x[i] = expf(x[i] - max_val);
+        sum += x[i];
+    }
+
+    float inv_sum = 1.0f / (sum + 1e-10f);
+    for (int i = 0; i < n; i++) {
+        x[i] *= inv_sum;
+    }
+}
+
+// Rows [t0, t0 + n) of a K or V stream. With a tile buffer the rows are
+// first copied into it (internal SRAM) and read back densely; without
+// one the source is used in place.
+static inline const void* stage_rows(void* tile, const void* src, int t0, int n,
+                                     int head_dim, int stride, size_t elem) {
+    const uint8_t* base = (const uint8_t*)src + (size_t)t0 * stride * elem;
+    if (!tile) return base;
+    if (stride == head_dim) {
+        memcpy(tile, base, (size_t)n * head_dim * elem);
+    } else {
+        for (int i = 0; i < n; i++) {
+            memcpy((uint8_t*)tile + (size_t)i * head_dim * elem,
+                   base + (size_t)i * stride * elem, head_dim * elem);
+        }
+    }
+    return tile;
+}
+
+// Single-head attention: scores over [0, pos], softmax, weighted sum of V
+void attention_head(float* out, const float* q, const float* k, const float* v,
+                    float* att, int pos, int head_dim, int stride, void* tile) {
+    float inv_sqrt = 1.0f / sqrtf((float)head_dim);
+    int row = tile ? head_dim : stride;
+
+    // Compute attention scores for all positions up to current
+    for (int t0 = 0; t0 <= pos; t0 += GPT_ATT_TILE) {
+        int n = pos + 1 - t0 < GPT_ATT_TILE ? pos + 1 - t0 : GPT_ATT_TILE;
+        const float* k_tile = (const float*)stage_rows(tile, k, t0, n, head_dim, stride, sizeof(float));
+        for (int i = 0; i < n; i++) {
+            const float* k_t = k_tile + i * row;
+            float score = 0.0f;
+            for (int d = 0; d < head_dim; d++) {
+                score += q[d] * k_t[d];
+            }
+            att[t0 + i] = score * inv_sqrt;
+        }
+    }
+
+    // Softmax over valid positions
+    softmax(att, pos + 1);
+
+    // Weighted sum of values
+    for (int d = 0; d < head_dim; d++) {
+        out[d] = 0.0f;
+    }
+    for (int t0 = 0; t0 <= pos; t0 += GPT_ATT_TILE) {
+        int n = pos + 1 - t0 < GPT_ATT_TILE ? pos + 1 - t0 : GPT_ATT_TILE;
+        const float* v_tile = (const float*)stage_rows(tile, v, t0, n, head_dim, stride, sizeof(float));
+        for (int i = 0; i < n; i++) {
+            const float* v_t = v_tile + i * row;
+            float att_weight = att[t0 + i];
+            for (int d = 0; d < head_dim; d++) {
+                out[d] += att_weight * v_t[d];
+            }
+        }
+    }
+}
+
+// ---------- reduced-precision KV cache ----------
+
+uint16_t fp32_to_fp16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    int32_t exp = (int32_t)((x >> 23) & 0xFF) - 127 + 15;
+    uint32_t mant = x & 0x7FFFFF;
+
+    if (((x >> 23) & 0xFF) == 0xFF) {
+        // Inf / NaN
+        return (uint16_t)(sign | 0x7C00 | (mant ? 0x200 : 0));
+    }
+    if (exp >= 31) return (uint16_t)(sign | 0x7BFF);  // saturate to +-65504
+    if (exp <= 0) {
+        // Subnormal or zero
+        if (exp < -10) return (uint16_t)sign;
+        mant |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exp);
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1))) half++;
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;  // may carry into exp: still correct
+    if (half > 0x7BFF) half = 0x7BFF;
+    return (uint16_t)(sign | half);
+}
+
+float fp16_to_fp32(uint16_t h) {
+    // Shift exponent+mantissa into place and rebias with one multiply by
+    // 2^112; handles zero, subnormal and normal halves (the cache never
+    // holds Inf/NaN because fp32_to_fp16 saturates)
+    uint32_t x = ((uint32_t)(h & 0x8000) << 16) | ((uint32_t)(h & 0x7FFF) << 13);
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f * 5.192296858534828e33f;
+}
+
+void kv_store_f16(uint16_t* dst, const float* src, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = fp32_to_fp16(src[i]);
+    }
+}
+
+void kv_store_q8(int8_t* dst, float* scale, const float* src, int n) {
+    float amax = 0.0f;
+    for (int i = 0; i < n; i++) {
+        float a = fabsf(src[i]);
+        if (a > amax) amax = a;
+    }
+    float s = amax / 127.0f;
+    float inv = s > 0.0f ? 1.0f / s : 0.0f;
+    for (int i = 0; i < n; i++) {
+        dst[i] = (int8_t)lrintf(src[i] * inv);
+    }
+    *scale = s;
+}
+
+void attention_head_f16(float* out, const float* q, const uint16_t* k, const uint16_t* v,
+                        float* att, int pos, int head_dim, int stride, void* tile) {
+    float inv_sqrt = 1.0f / sqrtf((float)head_dim);
+    int row = tile ? head_dim : stride;
+
+    for (int t0 = 0; t0 <= pos; t0 += GPT_ATT_TILE) {
+        int n = pos + 1 - t0 < GPT_ATT_TILE ? pos + 1 - t0 : GPT_ATT_TILE;
+        const uint16_t* k_tile = (const uint16_t*)stage_rows(tile, k, t0, n, head_dim, stride,
+                                                             sizeof(uint16_t));
+        for (int i = 0; i < n; i++) {
+            const uint16_t* k_t = k_tile + i * row;
+            float score = 0.0f;
+            for (int d = 0; d < head_dim; d++) {
+                score += q[d] * fp16_to_fp32(k_t[d]);
+            }
+            att[t0 + i] = score * inv_sqrt;
+        }
+    }
+
+    softmax(att, pos + 1);
+
+    for (int d = 0; d < head_dim; d++) {
+        out[d] = 0.0f;
+    }
+    for (int t0 = 0; t0 <= pos; t0 += GPT_ATT_TILE) {
+        int n = pos + 1 - t0 < GPT_ATT_TILE ? pos + 1 - t0 : GPT_ATT_TILE;
+        const uint16_t* v_tile = (const uint16_t*)stage_rows(tile, v, t0, n, head_dim, stride,
+                                                             sizeof(uint16_t));
+        for (int i = 0; i < n; i++) {
+            const uint16_t* v_t = v_tile + i * row;
+            float att_weight = att[t0 + i];
+            for (int d = 0; d < head_dim; d++) {
+                out[d] += att_weight * fp16_to_fp32(v_t[d]);
+            }
+        }
+    }
+}
+
+void attention_head_q8(float* out, const float* q,
+                       const int8_t* k, const float* k_scale,
+                       const int8_t* v, const float* v_scale,
+                       float* att, int pos, int head_dim, int stride, int scale_stride,
+                       void* tile) {
+    // Integer-valued K row dotted with float q, scaled once per position
+    float inv_sqrt = 1.0f / sqrtf((float)head_dim);
+    int row = tile ? head_dim : stride;
+
+    for (int t0 = 0; t0 <= pos; t0 += GPT_ATT_TILE) {
+        int n = pos + 1 - t0 < GPT_ATT_TILE ? pos + 1 - t0 : GPT_ATT_TILE;
+        const int8_t* k_tile = (const int8_t*)stage_rows(tile, k, t0, n, head_dim, stride,
+                                                         sizeof(int8_t));
+        for (int i = 0; i < n; i++) {
+            const int8_t* k_t = k_tile + i * row;
+            float score = 0.0f;
+            for (int d = 0; d < head_dim; d++) {
+                score += q[d] * (float)k_t[d];
+            }
+            att[t0 + i] = score * k_scale[(t0 + i) * scale_stride] * inv_sqrt;
+        }
+    }
+
+    softmax(att, pos + 1);
+
+    // Fold the V scale into the attention weight
+    for (int d = 0; d < head_dim; d++) {
+        out[d] = 0.0f;
+    }
+    for (int t0 = 0; t0 <= pos; t0 += GPT_ATT_TILE) {
+        int n = pos + 1 - t0 < GPT_ATT_TILE ? pos + 1 - t0 : GPT_ATT_TILE;
+        const int8_t* v_tile = (const int8_t*)stage_rows(tile, v, t0, n, head_dim, stride,
+                                                         sizeof(int8_t));
+        for (int i = 0; i < n; i++) {
+            const int8_t* v_t = v_tile + i * row;
+            float w = att[t0 + i] * v_scale[(t0 + i) * scale_stride];
+            for (int d = 0; d < head_dim; d++) {
+                out[d] += w * (float)v_t[d];
+            }
+        }
+    }
+}
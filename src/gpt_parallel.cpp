@@ -0,0 +1,184 @@
+#include "gpt_parallel.h"
+#include <Arduino.h>
+
+static GPTParallelFn jobFn;
+static void* jobCtx;
+static volatile bool enabled = true;
+static bool started = false;
+static bool busy = false;  // a job holds the helper
+
+// The helper serves one job at a time; a caller that finds it taken (another
+// session's forward pass) runs its job alone rather than waiting
+static bool claim_helper() {
+    return !__atomic_test_and_set(&busy, __ATOMIC_ACQUIRE);
+}
+
+static void release_helper() {
+    __atomic_clear(&busy, __ATOMIC_RELEASE);
+}
+
+void gpt_parallel_set_enabled(bool on) {
+    enabled = on;
+}
+
+int gpt_parallel_workers() {
+    return started && enabled ? GPT_PARALLEL_WORKERS : 1;
+}
+
+#ifdef HOST_BUILD
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// The helper polls for a short while after each job (the next one follows
+// within microseconds during a forward pass), then sleeps on the condvar.
+static const int SPIN_LIMIT = 20000;
+
+static std::thread helper;
+static std::mutex mtx;
+static std::condition_variable wake;
+static std::atomic<uint32_t> posted{0};
+static std::atomic<uint32_t> finished{0};
+static std::atomic<bool> stopping{false};
+
+static void helperLoop() {
+    uint32_t seen = 0;
+    for (;;) {
+        for (int spin = 0; spin < SPIN_LIMIT && posted.load(std::memory_order_acquire) == seen &&
+                           !stopping.load(std::memory_order_relaxed); spin++) {
+            std::this_thread::yield();
+        }
+        if (posted.load(std::memory_order_acquire) == seen) {
+            std::unique_lock<std::mutex> lock(mtx);
+            wake.wait(lock, [&] { return posted.load() != seen || stopping.load(); });
+        }
+        if (stopping.load()) return;
+        seen = posted.load(std::memory_order_acquire);
+        jobFn(jobCtx, 1, GPT_PARALLEL_WORKERS);
+        finished.store(seen, std::memory_order_release);
+    }
+}
+
+bool gpt_parallel_start(int) {
+    if (started) return true;
+    stopping = false;
+    helper = std::thread(helperLoop);
+    started = true;
+    return true;
+}
+
+void gpt_parallel_stop() {
+    if (!started) return;
+    // Take the helper like a job would, so an in-flight pass finishes first
+    while (!claim_helper()) std::this_thread::yield();
+    if (!started) {
+        release_helper();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    wake.notify_one();
+    helper.join();
+    started = false;
+    release_helper();
+}
+
+void gpt_parallel_run(GPTParallelFn fn, void* ctx) {
+    if (!enabled || !claim_helper()) {
+        fn(ctx, 0, 1);
+        return;
+    }
+    // Checked under the claim: stop() holds it while tearing the helper down
+    if (!started) {
+        release_helper();
+        fn(ctx, 0, 1);
+        return;
+    }
+    jobFn = fn;
+    jobCtx = ctx;
+    uint32_t job;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        job = posted.fetch_add(1, std::memory_order_release) + 1;
+    }
+    wake.notify_one();
+    fn(ctx, 0, GPT_PARALLEL_WORKERS);
+    while (finished.load(std::memory_order_acquire) != job) {
+        std::this_thread::yield();
+    }
+    release_helper();
+}
+
+#else
+
+static TaskHandle_t helperTask = nullptr;
+static TaskHandle_t callerTask = nullptr;
+
+static void helperLoop(void*) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!jobFn) break;
+        jobFn(jobCtx, 1, GPT_PARALLEL_WORKERS);
+        xTaskNotifyGive(callerTask);
+    }
+    xTaskNotifyGive(callerTask);
+    vTaskDelete(nullptr);
+}
+
+bool gpt_parallel_start(int core) {
+    if (started) return true;
+    // Above loop() (priority 1), which never blocks, so a notified helper
+    // runs at once instead of at the next tick
+    if (xTaskCreatePinnedToCore(helperLoop, "gpt_par", 4096, nullptr, 2, &helperTask, core) != pdPASS) {
+        Serial.println("[GPT] ERROR: Failed to start parallel worker");
+        helperTask = nullptr;
+        return false;
+    }
+    started = true;
+    Serial.printf("[GPT] Parallel worker on core %d\n", core);
+    return true;
+}
+
+void gpt_parallel_stop() {
+    if (!started) return;
+    // Take the helper like a job would, so an in-flight pass finishes before
+    // jobFn and callerTask are repurposed for the shutdown handshake
+    while (!claim_helper()) vTaskDelay(1);
+    if (!started) {
+        release_helper();
+        return;
+    }
+    callerTask = xTaskGetCurrentTaskHandle();
+    jobFn = nullptr;
+    xTaskNotifyGive(helperTask);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    helperTask = nullptr;
+    started = false;
+    release_helper();
+}
+
+void gpt_parallel_run(GPTParallelFn fn, void* ctx) {
+    if (!enabled || !claim_helper()) {
+        fn(ctx, 0, 1);
+        return;
+    }
+    // Checked under the claim: stop() holds it while tearing the helper down
+    if (!started) {
+        release_helper();
+        fn(ctx, 0, 1);
+        return;
+    }
+    callerTask = xTaskGetCurrentTaskHandle();
+    jobFn = fn;
+    jobCtx = ctx;
+    xTaskNotifyGive(helperTask);
+    fn(ctx, 0, GPT_PARALLEL_WORKERS);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    release_helper();
+}
+
+#endif
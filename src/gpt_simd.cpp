@@ -0,0 +1,451 @@
+#include "gpt_simd.h"
+#include "gpt_kernels.h"
+
+#if defined(__XTENSA__)
+#include <sdkconfig.h>
+#endif
+
+#if !defined(GPT_SIMD_SCALAR)
+#if defined(__SSE2__)
+#define GPT_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define GPT_SIMD_NEON
+#include <arm_neon.h>
+#elif defined(__XTENSA__) && defined(CONFIG_IDF_TARGET_ESP32S3)
+#define GPT_SIMD_PIE
+#endif
+#endif
+
+// ---------- reference ----------
+
+float dot_i8_f32_ref(const int8_t* w, const float* x, int n) {
+    float lane[GPT_DOT_LANES] = {};
+    int c = 0;
+    for (; c + GPT_DOT_LANES <= n; c += GPT_DOT_LANES) {
+        for (int l = 0; l < GPT_DOT_LANES; l++) {
+            lane[l] += (float)w[c + l] * x[c + l];
+        }
+    }
+    float sum = ((lane[0] + lane[4]) + (lane[2] + lane[6])) +
+                ((lane[1] + lane[5]) + (lane[3] + lane[7]));
+    for (; c < n; c++) {
+        sum += (float)w[c] * x[c];
+    }
+    return sum;
+}
+
+void dot4_i8_f32_ref(const int8_t* w, const float* const* x, int n, float* out) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = dot_i8_f32_ref(w, x[i], n);
+    }
+}
+
+int32_t dot_i8_i8_ref(const int8_t* a, const int8_t* b, int n) {
+    int32_t sum = 0;
+    for (int c = 0; c < n; c++) {
+        sum += (int32_t)a[c] * b[c];
+    }
+    return sum;
+}
+
+static inline int8_t nibble_lo(uint8_t b) { return (int8_t)(b << 4) >> 4; }
+static inline int8_t nibble_hi(uint8_t b) { return (int8_t)b >> 4; }
+
+float dot_q4_f32_ref(const uint8_t* w, const uint16_t* scales, int group, const float* x, int n) {
+    float total[GPT_DOT_LANES] = {};
+    for (int g0 = 0; g0 < n; g0 += group) {
+        float lane[GPT_DOT_LANES] = {};
+        for (int c = g0; c < g0 + group; c += GPT_DOT_LANES) {
+            for (int l = 0; l < GPT_DOT_LANES; l += 2) {
+                uint8_t b = w[(c + l) / 2];
+                lane[l] += (float)nibble_lo(b) * x[c + l];
+                lane[l + 1] += (float)nibble_hi(b) * x[c + l + 1];
+            }
+        }
+        float s = fp16_to_fp32(scales[g0 / group]);
+        for (int l = 0; l < GPT_DOT_LANES; l++) total[l] += lane[l] * s;
+    }
+    return ((total[0] + total[4]) + (total[2] + total[6])) +
+           ((total[1] + total[5]) + (total[3] + total[7]));
+}
+
+float dot_q4_i8_ref(const uint8_t* w, const uint16_t* scales, int group, const int8_t* x, int n) {
+    float sum = 0.0f;
+    for (int g0 = 0; g0 < n; g0 += group) {
+        int32_t acc = 0;
+        for (int c = g0; c < g0 + group; c += 2) {
+            uint8_t b = w[c / 2];
+            acc += (int32_t)nibble_lo(b) * x[c] + (int32_t)nibble_hi(b) * x[c + 1];
+        }
+        sum += (float)acc * fp16_to_fp32(scales[g0 / group]);
+    }
+    return sum;
+}
+
+// ---------- SSE2 ----------
+#if defined(GPT_SIMD_SSE2)
+
+// Eight int8 weights as two float vectors (lanes 0-3, 4-7)
+static inline void load8_i8(const int8_t* w, __m128* lo, __m128* hi) {
+    __m128i v = _mm_loadl_epi64((const __m128i*)w);
+    __m128i v16 = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+    *lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v16, v16), 16));
+    *hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v16, v16), 16));
+}
+
+// Lane order of dot_i8_f32_ref: (l0+l4, l1+l5, l2+l6, l3+l7), then pairs
+static inline float combine(__m128 acc_lo, __m128 acc_hi) {
+    __m128 t = _mm_add_ps(acc_lo, acc_hi);
+    __m128 u = _mm_add_ps(t, _mm_movehl_ps(t, t));
+    return _mm_cvtss_f32(u) + _mm_cvtss_f32(_mm_shuffle_ps(u, u, 1));
+}
+
+float dot_i8_f32(const int8_t* w, const float* x, int n) {
+    __m128 acc_lo = _mm_setzero_ps(), acc_hi = _mm_setzero_ps();
+    int c = 0;
+    for (; c + GPT_DOT_LANES <= n; c += GPT_DOT_LANES) {
+        __m128 w_lo, w_hi;
+        load8_i8(w + c, &w_lo, &w_hi);
+        acc_lo = _mm_add_ps(acc_lo, _mm_mul_ps(w_lo, _mm_loadu_ps(x + c)));
+        acc_hi = _mm_add_ps(acc_hi, _mm_mul_ps(w_hi, _mm_loadu_ps(x + c + 4)));
+    }
+    float sum = combine(acc_lo, acc_hi);
+    for (; c < n; c++) {
+        sum += (float)w[c] * x[c];
+    }
+    return sum;
+}
+
+void dot4_i8_f32(const int8_t* w, const float* const* x, int n, float* out) {
+    __m128 lo[4], hi[4];
+    for (int i = 0; i < 4; i++) lo[i] = hi[i] = _mm_setzero_ps();
+    int c = 0;
+    for (; c + GPT_DOT_LANES <= n; c += GPT_DOT_LANES) {
+        __m128 w_lo, w_hi;
+        load8_i8(w + c, &w_lo, &w_hi);
+        for (int i = 0; i < 4; i++) {
+            lo[i] = _mm_add_ps(lo[i], _mm_mul_ps(w_lo, _mm_loadu_ps(x[i] + c)));
+            hi[i] = _mm_add_ps(hi[i], _mm_mul_ps(w_hi, _mm_loadu_ps(x[i] + c + 4)));
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        float sum = combine(lo[i], hi[i]);
+        for (int t = c; t < n; t++) {
+            sum += (float)w[t] * x[i][t];
+        }
+        out[i] = sum;
+    }
+}
+
+int32_t dot_i8_i8(const int8_t* a, const int8_t* b, int n) {
+    __m128i acc = _mm_setzero_si128();
+    int c = 0;
+    for (; c + 16 <= n; c += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + c));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + c));
+        __m128i a_lo = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+        __m128i a_hi = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+        __m128i b_lo = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+        __m128i b_hi = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(a_lo, b_lo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(a_hi, b_hi));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t sum = _mm_cvtsi128_si32(acc);
+    for (; c < n; c++) {
+        sum += (int32_t)a[c] * b[c];
+    }
+    return sum;
+}
+
+// 8 bytes of nibbles to 16 int8 in element order: mask both halves,
+// sign-extend with (x ^ 8) - 8, interleave
+static inline __m128i unpack16_q4(const uint8_t* w) {
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    const __m128i eight = _mm_set1_epi8(8);
+    __m128i v = _mm_loadl_epi64((const __m128i*)w);
+    __m128i lo = _mm_and_si128(v, mask);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+    lo = _mm_sub_epi8(_mm_xor_si128(lo, eight), eight);
+    hi = _mm_sub_epi8(_mm_xor_si128(hi, eight), eight);
+    return _mm_unpacklo_epi8(lo, hi);
+}
+
+float dot_q4_f32(const uint8_t* w, const uint16_t* scales, int group, const float* x, int n) {
+    __m128 tot_lo = _mm_setzero_ps(), tot_hi = _mm_setzero_ps();
+    for (int g0 = 0; g0 < n; g0 += group) {
+        __m128 acc_lo = _mm_setzero_ps(), acc_hi = _mm_setzero_ps();
+        for (int c = g0; c < g0 + group; c += 16) {
+            __m128i v = unpack16_q4(w + c / 2);
+            __m128i v_lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+            __m128i v_hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+            __m128 e0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v_lo, v_lo), 16));
+            __m128 e1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v_lo, v_lo), 16));
+            __m128 e2 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v_hi, v_hi), 16));
+            __m128 e3 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v_hi, v_hi), 16));
+            acc_lo = _mm_add_ps(acc_lo, _mm_mul_ps(e0, _mm_loadu_ps(x + c)));
+            acc_hi = _mm_add_ps(acc_hi, _mm_mul_ps(e1, _mm_loadu_ps(x + c + 4)));
+            acc_lo = _mm_add_ps(acc_lo, _mm_mul_ps(e2, _mm_loadu_ps(x + c + 8)));
+            acc_hi = _mm_add_ps(acc_hi, _mm_mul_ps(e3, _mm_loadu_ps(x + c + 12)));
+        }
+        __m128 s = _mm_set1_ps(fp16_to_fp32(scales[g0 / group]));
+        tot_lo = _mm_add_ps(tot_lo, _mm_mul_ps(acc_lo, s));
+        tot_hi = _mm_add_ps(tot_hi, _mm_mul_ps(acc_hi, s));
+    }
+    return combine(tot_lo, tot_hi);
+}
+
+float dot_q4_i8(const uint8_t* w, const uint16_t* scales, int group, const int8_t* x, int n) {
+    float sum = 0.0f;
+    for (int g0 = 0; g0 < n; g0 += group) {
+        __m128i acc = _mm_setzero_si128();
+        for (int c = g0; c < g0 + group; c += 16) {
+            __m128i va = unpack16_q4(w + c / 2);
+            __m128i vb = _mm_loadu_si128((const __m128i*)(x + c));
+            __m128i a_lo = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+            __m128i a_hi = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+            __m128i b_lo = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+            __m128i b_hi = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(a_lo, b_lo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(a_hi, b_hi));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum += (float)_mm_cvtsi128_si32(acc) * fp16_to_fp32(scales[g0 / group]);
+    }
+    return sum;
+}
+
+const char* gpt_simd_name() { return "sse2"; }
+
+// ---------- NEON ----------
+#elif defined(GPT_SIMD_NEON)
+
+static inline void load8_i8(const int8_t* w, float32x4_t* lo, float32x4_t* hi) {
+    int16x8_t v16 = vmovl_s8(vld1_s8(w));
+    *lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v16)));
+    *hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v16)));
+}
+
+static inline float combine(float32x4_t acc_lo, float32x4_t acc_hi) {
+    float32x4_t t = vaddq_f32(acc_lo, acc_hi);
+    float32x2_t u = vadd_f32(vget_low_f32(t), vget_high_f32(t));
+    return vget_lane_f32(u, 0) + vget_lane_f32(u, 1);
+}
+
+float dot_i8_f32(const int8_t* w, const float* x, int n) {
+    float32x4_t acc_lo = vdupq_n_f32(0.0f), acc_hi = vdupq_n_f32(0.0f);
+    int c = 0;
+    for (; c + GPT_DOT_LANES <= n; c += GPT_DOT_LANES) {
+        float32x4_t w_lo, w_hi;
+        load8_i8(w + c, &w_lo, &w_hi);
+        acc_lo = vaddq_f32(acc_lo, vmulq_f32(w_lo, vld1q_f32(x + c)));
+        acc_hi = vaddq_f32(acc_hi, vmulq_f32(w_hi, vld1q_f32(x + c + 4)));
+    }
+    float sum = combine(acc_lo, acc_hi);
+    for (; c < n; c++) {
+        sum += (float)w[c] * x[c];
+    }
+    return sum;
+}
+
+void dot4_i8_f32(const int8_t* w, const float* const* x, int n, float* out) {
+    float32x4_t lo[4], hi[4];
+    for (int i = 0; i < 4; i++) lo[i] = hi[i] = vdupq_n_f32(0.0f);
+    int c = 0;
+    for (; c + GPT_DOT_LANES <= n; c += GPT_DOT_LANES) {
+        float32x4_t w_lo, w_hi;
+        load8_i8(w + c, &w_lo, &w_hi);
+        for (int i = 0; i < 4; i++) {
+            lo[i] = vaddq_f32(lo[i], vmulq_f32(w_lo, vld1q_f32(x[i] + c)));
+            hi[i] = vaddq_f32(hi[i], vmulq_f32(w_hi, vld1q_f32(x[i] + c + 4)));
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        float sum = combine(lo[i], hi[i]);
+        for (int t = c; t < n; t++) {
+            sum += (float)w[t] * x[i][t];
+        }
+        out[i] = sum;
+    }
+}
+
+int32_t dot_i8_i8(const int8_t* a, const int8_t* b, int n) {
+    int32x4_t acc = vdupq_n_s32(0);
+    int c = 0;
+    for (; c + 16 <= n; c += 16) {
+        int8x16_t va = vld1q_s8(a + c);
+        int8x16_t vb = vld1q_s8(b + c);
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+        acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(va), vget_high_s8(vb)));
+    }
+    int32x2_t pair = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    int32_t sum = vget_lane_s32(pair, 0) + vget_lane_s32(pair, 1);
+    for (; c < n; c++) {
+        sum += (int32_t)a[c] * b[c];
+    }
+    return sum;
+}
+
+static inline int8x16_t unpack16_q4(const uint8_t* w) {
+    uint8x8_t v = vld1_u8(w);
+    int8x8_t lo = vreinterpret_s8_u8(vand_u8(v, vdup_n_u8(0x0F)));
+    int8x8_t hi = vreinterpret_s8_u8(vshr_n_u8(v, 4));
+    const int8x8_t eight = vdup_n_s8(8);
+    lo = vsub_s8(veor_s8(lo, eight), eight);
+    hi = vsub_s8(veor_s8(hi, eight), eight);
+    int8x8x2_t z = vzip_s8(lo, hi);
+    return vcombine_s8(z.val[0], z.val[1]);
+}
+
+float dot_q4_f32(const uint8_t* w, const uint16_t* scales, int group, const float* x, int n) {
+    float32x4_t tot_lo = vdupq_n_f32(0.0f), tot_hi = vdupq_n_f32(0.0f);
+    for (int g0 = 0; g0 < n; g0 += group) {
+        float32x4_t acc_lo = vdupq_n_f32(0.0f), acc_hi = vdupq_n_f32(0.0f);
+        for (int c = g0; c < g0 + group; c += 16) {
+            int8x16_t v = unpack16_q4(w + c / 2);
+            int16x8_t v_lo = vmovl_s8(vget_low_s8(v));
+            int16x8_t v_hi = vmovl_s8(vget_high_s8(v));
+            float32x4_t e0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v_lo)));
+            float32x4_t e1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v_lo)));
+            float32x4_t e2 = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v_hi)));
+            float32x4_t e3 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v_hi)));
+            acc_lo = vaddq_f32(acc_lo, vmulq_f32(e0, vld1q_f32(x + c)));
+            acc_hi = vaddq_f32(acc_hi, vmulq_f32(e1, vld1q_f32(x + c + 4)));
+            acc_lo = vaddq_f32(acc_lo, vmulq_f32(e2, vld1q_f32(x + c + 8)));
+            acc_hi = vaddq_f32(acc_hi, vmulq_f32(e3, vld1q_f32(x + c + 12)));
+        }
+        float32x4_t s = vdupq_n_f32(fp16_to_fp32(scales[g0 / group]));
+        tot_lo = vaddq_f32(tot_lo, vmulq_f32(acc_lo, s));
+        tot_hi = vaddq_f32(tot_hi, vmulq_f32(acc_hi, s));
+    }
+    return combine(tot_lo, tot_hi);
+}
+
+float dot_q4_i8(const uint8_t* w, const uint16_t* scales, int group, const int8_t* x, int n) {
+    float sum = 0.0f;
+    for (int g0 = 0; g0 < n; g0 += group) {
+        int32x4_t acc = vdupq_n_s32(0);
+        for (int c = g0; c < g0 + group; c += 16) {
+            int8x16_t va = unpack16_q4(w + c / 2);
+            int8x16_t vb = vld1q_s8(x + c);
+            acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+            acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(va), vget_high_s8(vb)));
+        }
+        int32x2_t pair = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+        int32_t isum = vget_lane_s32(pair, 0) + vget_lane_s32(pair, 1);
+        sum += (float)isum * fp16_to_fp32(scales[g0 / group]);
+    }
+    return sum;
+}
+
+const char* gpt_simd_name() { return "neon"; }
+
+// ---------- ESP32-S3 PIE ----------
+#elif defined(GPT_SIMD_PIE)
+
+float dot_i8_f32(const int8_t* w, const float* x, int n) {
+    return dot_i8_f32_ref(w, x, n);
+}
+
+void dot4_i8_f32(const int8_t* w, const float* const* x, int n, float* out) {
+    dot4_i8_f32_ref(w, x, n, out);
+}
+
+// 16 int8 products per EE.VMULAS into the 40-bit ACCX accumulator.
+// EE.VLD.128 ignores the low four address bits, hence the alignment rule.
+// GCC has no clobber names for q0/q1 or LBEG/LEND/LCOUNT. It never
+// allocates q registers, and only builds zero-overhead loops around
+// call-free bodies, so keeping this out of line stops the loopnez from
+// landing inside one of them.
+__attribute__((noinline))
+int32_t dot_i8_i8(const int8_t* a, const int8_t* b, int n) {
+    if ((((uintptr_t)a | (uintptr_t)b) & 15) || (n & 15)) return dot_i8_i8_ref(a, b, n);
+    int32_t sum;
+    int blocks = n >> 4;
+    asm volatile(
+        "ee.zero.accx\n"
+        "loopnez %[blocks], 1f\n"
+        "ee.vld.128.ip q0, %[a], 16\n"
+        "ee.vld.128.ip q1, %[b], 16\n"
+        "ee.vmulas.s8.accx q0, q1\n"
+        "1:\n"
+        "rur.accx_0 %[sum]\n"
+        : [a] "+r"(a), [b] "+r"(b), [sum] "=r"(sum)
+        : [blocks] "r"(blocks)
+        : "memory");
+    return sum;
+}
+
+float dot_q4_f32(const uint8_t* w, const uint16_t* scales, int group, const float* x, int n) {
+    return dot_q4_f32_ref(w, scales, group, x, n);
+}
+
+// Each group is unpacked into an aligned buffer for the ACCX dot product
+float dot_q4_i8(const uint8_t* w, const uint16_t* scales, int group, const int8_t* x, int n) {
+    alignas(16) int8_t unpacked[GPT_Q4_GROUP_MAX];
+    float sum = 0.0f;
+    for (int g0 = 0; g0 < n; g0 += group) {
+        for (int c = 0; c < group; c += 2) {
+            uint8_t b = w[(g0 + c) / 2];
+            unpacked[c] = nibble_lo(b);
+            unpacked[c + 1] = nibble_hi(b);
+        }
+        sum += (float)dot_i8_i8(unpacked, x + g0, group) * fp16_to_fp32(scales[g0 / group]);
+    }
+    return sum;
+}
+
+const char* gpt_simd_name() { return "pie"; }
+
+// ---------- scalar ----------
+#else
+
+float dot_i8_f32(const int8_t* w, const float* x, int n) {
+    return dot_i8_f32_ref(w, x, n);
+}
+
+void dot4_i8_f32(const int8_t* w, const float* const* x, int n, float* out) {
+    dot4_i8_f32_ref(w, x, n, out);
+}
+
+int32_t dot_i8_i8(const int8_t* a, const int8_t* b, int n) {
+    return dot_i8_i8_ref(a, b, n);
+}
+
+float dot_q4_f32(const uint8_t* w, const uint16_t* scales, int group, const float* x, int n) {
+    return dot_q4_f32_ref(w, scales, group, x, n);
+}
+
+float dot_q4_i8(const uint8_t* w, const uint16_t* scales, int group, const int8_t* x, int n) {
+    return dot_q4_i8_ref(w, scales, group, x, n);
+}
+
+const char* gpt_simd_name() { return "scalar"; }
+
+#endif
+
+bool gpt_simd_check() {
+    static const int N = 256;
+    alignas(16) int8_t a[N + 16];
+    alignas(16) int8_t b[N + 16];
+    uint32_t x = 0x9e3779b9u;
+    for (int c = 0; c < N + 16; c++) {
+        x = x * 1664525u + 1013904223u;
+        a[c] = (int8_t)(x >> 24);
+        b[c] = (int8_t)(x >> 16);
+    }
+    // Full-range extremes so the accumulator sees its largest products
+    a[0] = b[0] = -128;
+    a[1] = 127;
+    b[1] = -128;
+    static const int lengths[] = { 0, 16, 32, 48, 128, N, 40 };
+    for (int n : lengths) {
+        for (int off = 0; off < 2; off++) {
+            if (dot_i8_i8(a + off, b + off, n) != dot_i8_i8_ref(a + off, b + off, n)) return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,681 @@
+// End-to-end generation benchmark: drives gpt_generate like genWorker
+// ("MML@" prompt, or --prompt for seeded continuations) with a fixed seed and reports time-to-first-token,
+// tokens/sec per context-position bucket and peak SRAM/PSRAM. With
+// --baseline it compares against a previous JSON report and exits non-zero
+// when tokens/sec or TTFT regress by more than --threshold percent (TTFT
+// only once it also grows by TTFT_FLOOR_MS; a one-token prompt prefills in
+// well under that, where the percentage is timer noise).
+// With --w8a8 it also scores built-in songs with int8 and fp32 matmul
+// inputs and reports how far the W8A8 logits drift ("w8a8_accuracy").
+// The timed runs drop prompt prefix snapshots first, so ttft_ms is always
+// a full prefill; with snapshots on (the default, --no-prefix turns them
+// off) one more run then resumes the prompt from the last run's snapshot
+// and reports "ttft_resumed_ms". "deterministic" means every run,
+// resumed or not, generated the same text.
+// With --mmap the model is mapped from DIR/model.bin through the flash
+// partition shim instead of being copied into (simulated) PSRAM.
+// --sessions N then runs N more generations at once, one thread and
+// GPTSession each on the shared model, and checks they all reproduce the
+// single-session output ("sessions_match"); N is capped at the sessions
+// the simulated memory holds ("sessions_requested" keeps the asked N). --batch-curve N times
+// gpt_generate_batch at batch sizes 1, 2, 4 .. N (seeds seed, seed + 1,
+// ..., temperatures varied per sequence, speculative decoding off) and
+// checks every sequence against gpt_generate with the same seed and
+// temperature ("batch_match"). --check-draft forces grammar dead ends
+// into early-exit drafts past the KV window and checks the cache against
+// plain scoring of the same tokens ("draft_check").
+//
+//   bench_generate [--data DIR] [--prompt S] [--tokens N] [--temp T] [--seed S] [--runs N]
+//                  [--kv f32|f16|int8] [--no-grammar] [--draft] [--draft-layers N]
+//                  [--workers 1|2] [--w8a8] [--mmap] [--no-prefix] [--sessions N] [--batch-curve N]
+//                  [--check-draft] [--out FILE] [--baseline FILE] [--threshold PCT]
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <esp_heap_caps.h>
+#include "mini_gpt.h"
+#include "music.h"
+#include "songs.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+static const int BUCKET = 128;
+static const double TTFT_FLOOR_MS = 1.0;  // TTFT growth the gate ignores
+
+using Clock = std::chrono::steady_clock;
+
+struct RunStats {
+    int tokens;
+    int promptTokens;
+    bool mmlValid;                    // whole output accepted by the MML grammar
+    uint32_t draftProposed;
+    uint32_t draftAccepted;
+    uint32_t passes;                  // decode forward passes
+    int prefixReused;                 // prompt tokens restored from a snapshot
+    uint32_t outputHash;              // FNV-1a of the generated text
+    double totalMs;
+    double ttftMs;
+    double tokPerSec;                 // steady state (after first token)
+    std::vector<double> bucketTps;    // indexed by position / BUCKET
+    std::vector<int> bucketTokens;
+};
+
+struct Probe {
+    Clock::time_point start;
+    std::vector<Clock::time_point> stamps;
+};
+
+static void onToken(const char*, void* userData) {
+    ((Probe*)userData)->stamps.push_back(Clock::now());
+}
+
+static double ms(Clock::time_point a, Clock::time_point b) {
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+static RunStats runOnce(GPTSession* session, const char* prompt, int maxTokens, float temperature,
+                        uint32_t seed) {
+    const GPTModel* model = session->model;
+    gpt_seed(session, seed);
+    Probe probe;
+    probe.stamps.reserve(maxTokens);
+    probe.start = Clock::now();
+    char* out = gpt_generate(session, prompt, maxTokens, temperature, onToken, &probe);
+    Clock::time_point end = Clock::now();
+
+    RunStats s = {};
+    MMLGrammar g;
+    mmlGrammarInit(g);
+    s.mmlValid = out && mmlGrammarFeed(g, out) && mmlGrammarCanEnd(g);
+    s.outputHash = 2166136261u;
+    for (const char* c = out ? out : ""; *c; c++) s.outputHash = (s.outputHash ^ (uint8_t)*c) * 16777619u;
+    free(out);
+    s.prefixReused = session->prefix.reused;
+    s.draftProposed = session->draft.proposed;
+    s.draftAccepted = session->draft.accepted;
+    s.passes = session->draft.passes;
+
+    s.tokens = (int)probe.stamps.size();
+    std::vector<int> promptIds(strlen(prompt) + 1);
+    s.promptTokens = gpt_encode(model, prompt, promptIds.data(), (int)promptIds.size());
+    s.totalMs = ms(probe.start, end);
+    s.ttftMs = s.tokens > 0 ? ms(probe.start, probe.stamps[0]) : s.totalMs;
+    if (s.tokens > 1) {
+        s.tokPerSec = (s.tokens - 1) * 1000.0 / ms(probe.stamps[0], probe.stamps.back());
+    }
+
+    // Interval i (between callbacks i-1 and i) ends with the token at
+    // position promptTokens + i - 1; with drafts one pass spans several
+    int lastPos = std::max((int)model->config.block_size, session->pos);
+    int nBuckets = (lastPos + BUCKET - 1) / BUCKET;
+    std::vector<double> bucketMs(nBuckets, 0.0);
+    s.bucketTokens.assign(nBuckets, 0);
+    for (int i = 1; i < s.tokens; i++) {
+        int b = (s.promptTokens + i - 1) / BUCKET;
+        if (b >= nBuckets) b = nBuckets - 1;
+        bucketMs[b] += ms(probe.stamps[i - 1], probe.stamps[i]);
+        s.bucketTokens[b]++;
+    }
+    s.bucketTps.assign(nBuckets, 0.0);
+    for (int b = 0; b < nBuckets; b++) {
+        if (s.bucketTokens[b] > 0) s.bucketTps[b] = s.bucketTokens[b] * 1000.0 / bucketMs[b];
+    }
+    return s;
+}
+
+// Pull a numeric top-level field out of a previous report. Rows of
+// "buckets" and "batch_curve" reuse key names, so nested objects and
+// arrays are skipped.
+static bool readBaseline(const char* path, const char* key, double* value) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) return false;
+    std::string text;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) text.append(chunk, n);
+    fclose(fp);
+
+    std::string needle = std::string("\"") + key + "\":";
+    int depth = 0;
+    bool inString = false;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (inString) {
+            if (c == '\\') i++;
+            else if (c == '"') inString = false;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            depth--;
+        } else if (c == '"') {
+            if (depth == 1 && text.compare(i, needle.size(), needle) == 0) {
+                *value = atof(text.c_str() + i + needle.size());
+                return true;
+            }
+            inString = true;
+        }
+    }
+    return false;
+}
+
+static GPTKVType parseKVType(const char* name) {
+    if (!strcmp(name, "f16")) return GPT_KV_F16;
+    if (!strcmp(name, "int8")) return GPT_KV_INT8;
+    return GPT_KV_F32;
+}
+
+// Prompt as a JSON string body
+static std::string jsonEscape(const char* s) {
+    std::string out;
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') out += '\\';
+        out += *s;
+    }
+    return out;
+}
+
+// Draft corpus: the built-in MML songs, as on the device
+static void buildDraftIndex(GPTModel* model) {
+    std::vector<const char*> texts;
+    for (uint16_t i = 0; i < SONG_DEF_COUNT; i++) {
+        if (songDefs[i].fmt == FMT_MML) texts.push_back(songDefs[i].str);
+    }
+    gpt_draft_build(model, texts.data(), (int)texts.size());
+}
+
+struct BatchPoint {
+    int batch;
+    int tokens;         // generated by all sequences
+    double ms;
+    double tokPerSec;   // aggregate
+};
+
+static void countToken(const char*, void* userData) {
+    (*(int*)userData)++;
+}
+
+// Aggregate throughput of gpt_generate_batch at batch sizes 1, 2, 4 ..
+// pool.size(). Sequence i runs in pool[i], seeded seed + i, at
+// temperature + 0.1 * (i % 3); its text must match a plain gpt_generate
+// run of pool[0] with that seed and temperature.
+static std::vector<BatchPoint> runBatchCurve(const std::vector<GPTSession*>& pool, const char* prompt,
+                                             int maxTokens, float temperature, uint32_t seed,
+                                             bool* match) {
+    int maxBatch = (int)pool.size();
+    std::vector<std::string> reference(maxBatch);
+    std::vector<float> temps(maxBatch);
+    for (int i = 0; i < maxBatch; i++) {
+        temps[i] = temperature + 0.1f * (i % 3);
+        gpt_seed(pool[0], seed + i);
+        char* out = gpt_generate(pool[0], prompt, maxTokens, temps[i], nullptr, nullptr);
+        reference[i] = out ? out : "";
+        free(out);
+    }
+
+    std::vector<BatchPoint> curve;
+    for (int batch = 1; batch <= maxBatch; batch = batch < maxBatch ? std::min(batch * 2, maxBatch) : batch + 1) {
+        GPTBatchItem items[GPT_BATCH_MAX] = {};
+        int counts[GPT_BATCH_MAX] = {};
+        for (int i = 0; i < batch; i++) {
+            gpt_seed(pool[i], seed + i);
+            items[i].session = pool[i];
+            items[i].prompt = prompt;
+            items[i].temperature = temps[i];
+            items[i].user_data = &counts[i];
+        }
+        Clock::time_point start = Clock::now();
+        gpt_generate_batch(items, batch, maxTokens, countToken);
+        BatchPoint p = { batch, 0, ms(start, Clock::now()), 0.0 };
+        for (int i = 0; i < batch; i++) {
+            p.tokens += counts[i];
+            *match &= items[i].output && reference[i] == items[i].output;
+            free(items[i].output);
+        }
+        p.tokPerSec = p.tokens * 1000.0 / p.ms;
+        curve.push_back(p);
+    }
+    return curve;
+}
+
+// --check-draft: drafts cut short by a grammar dead end must leave the KV
+// ring as plain decoding would. With the digit tokens blanked, a bare
+// "o", "t", "l" or "v" leaves nothing the grammar accepts; the prompt is
+// the longest built-in song without its ';', so every dead end comes after
+// the ring has wrapped. The cache after the speculative run must equal the
+// cache from scoring the same tokens with gpt_score.
+struct TokenLog {
+    const GPTModel* model;
+    std::vector<int> ids;
+};
+
+static void logToken(const char* token, void* userData) {
+    TokenLog* log = (TokenLog*)userData;
+    // Token texts are distinct pointers into the token map
+    for (int i = 0; i < log->model->config.vocab_size; i++) {
+        if (log->model->tokenMap.tokens[i] == token) {
+            log->ids.push_back(i);
+            break;
+        }
+    }
+}
+
+static const int DRAFT_CHECK_RUNS = 16;
+
+struct DraftCheck {
+    int runs;
+    int mismatches;  // runs whose cache differs from plain scoring
+    int minPos;      // fewest tokens in the cache at the end of a run
+    int deadEnds;    // bare command letters emitted, all runs
+};
+
+static DraftCheck checkDraftRestore(GPTModel* model, GPTSession* session, GPTKVType kvType,
+                                    float temperature, uint32_t seed) {
+    DraftCheck check = { 0, 0, INT32_MAX, 0 };
+    const GPTConfig& cfg = model->config;
+    const char* song = "";
+    for (uint16_t i = 0; i < SONG_DEF_COUNT; i++) {
+        if (songDefs[i].fmt == FMT_MML && strlen(songDefs[i].str) > strlen(song)) song = songDefs[i].str;
+    }
+    // The prompt may not use the blanked tokens: keep what still parses
+    // once digits and the commands that need them are gone, up to a bit
+    // past the window
+    std::string prompt = "MML@";
+    MMLGrammar g;
+    mmlGrammarInit(g);
+    mmlGrammarFeed(g, "MML@");
+    for (const char* c = strchr(song, '@') + 1; *c && *c != ';' && (int)prompt.size() < cfg.block_size * 5 / 4; c++) {
+        if (isdigit((unsigned char)*c) || strchr("otlvOTLV", *c)) continue;
+        if (mmlGrammarStep(g, *c)) prompt += *c;
+    }
+
+    GPTSession ref = {};
+    if (!gpt_session_init(&ref, model, kvType)) {
+        fprintf(stderr, "draft check: no memory for the reference session\n");
+        check.mismatches = 1;
+        return check;
+    }
+    ref.w8a8 = session->w8a8;
+
+    std::vector<const char*> texts(model->tokenMap.tokens, model->tokenMap.tokens + cfg.vocab_size);
+    for (int i = 0; i < cfg.vocab_size; i++) {
+        if (isdigit((unsigned char)texts[i][0])) model->tokenMap.tokens[i] = texts[i] + strlen(texts[i]);
+    }
+    bool prefixCache = session->prefix_cache;
+    GPTSpecMode speculative = session->speculative;
+    session->prefix_cache = false;
+    if (speculative == GPT_SPEC_OFF) session->speculative = GPT_SPEC_EARLY_EXIT;
+
+    static const size_t elemBytes[] = { 4, 2, 1 };
+    size_t bytes = (size_t)cfg.n_layer * cfg.block_size * cfg.n_embd * elemBytes[kvType];
+    size_t scales = (size_t)cfg.n_layer * cfg.n_head * cfg.block_size * sizeof(float);
+    std::vector<int> tokens(prompt.size() + 256);
+    std::vector<float> logits(tokens.size() * cfg.vocab_size);
+    for (int r = 0; r < DRAFT_CHECK_RUNS; r++) {
+        TokenLog log = { model, {} };
+        gpt_seed(session, seed + r);
+        free(gpt_generate(session, prompt.c_str(), 200, temperature, logToken, &log));
+        int pos = session->pos;
+
+        int n = gpt_encode(model, prompt.c_str(), tokens.data(), (int)prompt.size());
+        for (int id : log.ids) {
+            tokens[n++] = id;
+            const char* t = texts[id];
+            check.deadEnds += t[1] == '\0' && strchr("otlvOTL", t[0]) != nullptr;
+        }
+        bool match = pos <= n;
+        if (match) {
+            gpt_score(&ref, tokens.data(), pos, logits.data());
+            match = !memcmp(session->cache.k, ref.cache.k, bytes) &&
+                    !memcmp(session->cache.v, ref.cache.v, bytes);
+            if (kvType == GPT_KV_INT8) {
+                match &= !memcmp(session->cache.k_scale, ref.cache.k_scale, scales) &&
+                         !memcmp(session->cache.v_scale, ref.cache.v_scale, scales);
+            }
+        }
+        check.runs++;
+        check.mismatches += !match;
+        check.minPos = std::min(check.minPos, pos);
+    }
+
+    for (int i = 0; i < cfg.vocab_size; i++) model->tokenMap.tokens[i] = texts[i];
+    session->prefix_cache = prefixCache;
+    session->speculative = speculative;
+    gpt_session_free(&ref);
+    return check;
+}
+
+// Songs scored by the W8A8 accuracy check (first block_size tokens each)
+static const int ACCURACY_SONGS = 16;
+
+struct Accuracy {
+    int tokens;
+    double top1;         // fraction of positions with the same argmax
+    double kl;           // mean KL(fp32 || w8a8) in nats
+    double nllRef;       // mean next-token NLL, fp32 inputs
+    double nll;          // mean next-token NLL, W8A8
+    double maxLogitErr;  // largest |logit difference|
+};
+
+// log-softmax of one logits row into lp
+static void logSoftmax(const float* logits, int n, std::vector<double>& lp) {
+    double mx = logits[0];
+    for (int i = 1; i < n; i++) mx = std::max(mx, (double)logits[i]);
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) sum += exp(logits[i] - mx);
+    double lse = mx + log(sum);
+    lp.resize(n);
+    for (int i = 0; i < n; i++) lp[i] = logits[i] - lse;
+}
+
+// Teacher-forced comparison of the W8A8 path against fp32 inputs
+static Accuracy compareW8A8(GPTSession* session) {
+    const GPTModel* model = session->model;
+    int vocab = model->config.vocab_size;
+    int block = model->config.block_size;
+    std::vector<int> ids;
+    std::vector<float> ref, q8;
+    std::vector<double> lpRef, lpQ8;
+    Accuracy a = {};
+    int agree = 0, songs = 0;
+    for (uint16_t s = 0; s < SONG_DEF_COUNT && songs < ACCURACY_SONGS; s++) {
+        if (songDefs[s].fmt != FMT_MML) continue;
+        songs++;
+        ids.assign(strlen(songDefs[s].str) + 1, 0);
+        int n = gpt_encode(model, songDefs[s].str, ids.data(), (int)ids.size());
+        n = std::min(n, block);
+        if (n < 2) continue;
+        ref.resize((size_t)n * vocab);
+        q8.resize((size_t)n * vocab);
+        session->w8a8 = false;
+        gpt_score(session, ids.data(), n, ref.data());
+        session->w8a8 = true;
+        gpt_score(session, ids.data(), n, q8.data());
+
+        // Row i predicts ids[i + 1]
+        for (int i = 0; i + 1 < n; i++) {
+            const float* r = &ref[(size_t)i * vocab];
+            const float* q = &q8[(size_t)i * vocab];
+            logSoftmax(r, vocab, lpRef);
+            logSoftmax(q, vocab, lpQ8);
+            int argRef = 0, argQ8 = 0;
+            double kl = 0.0;
+            for (int v = 0; v < vocab; v++) {
+                if (r[v] > r[argRef]) argRef = v;
+                if (q[v] > q[argQ8]) argQ8 = v;
+                kl += exp(lpRef[v]) * (lpRef[v] - lpQ8[v]);
+                a.maxLogitErr = std::max(a.maxLogitErr, (double)fabsf(r[v] - q[v]));
+            }
+            agree += argRef == argQ8;
+            a.kl += kl;
+            a.nllRef -= lpRef[ids[i + 1]];
+            a.nll -= lpQ8[ids[i + 1]];
+            a.tokens++;
+        }
+    }
+    if (a.tokens > 0) {
+        a.top1 = (double)agree / a.tokens;
+        a.kl /= a.tokens;
+        a.nllRef /= a.tokens;
+        a.nll /= a.tokens;
+    }
+    return a;
+}
+
+int main(int argc, char** argv) {
+    const char* prompt = "MML@";
+    bool grammar = true;
+    GPTSpecMode speculative = GPT_SPEC_OFF;
+    int draftLayers = 2;
+    int workers = 1;
+    bool w8a8 = false;
+    bool mapped = false;
+    bool prefixCache = true;
+    int sessions = 0;
+    int batchMax = 0;
+    bool checkDraft = false;
+    int maxTokens = 900;
+    float temperature = 0.8f;
+    GPTKVType kvType = GPT_KV_F32;
+    uint32_t seed = 42;
+    int runs = 3;
+    const char* outPath = nullptr;
+    const char* baselinePath = nullptr;
+    double thresholdPct = 10.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--data") && i + 1 < argc) LittleFS.setRoot(argv[++i]);
+        else if (!strcmp(argv[i], "--prompt") && i + 1 < argc) prompt = argv[++i];
+        else if (!strcmp(argv[i], "--tokens") && i + 1 < argc) maxTokens = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--temp") && i + 1 < argc) temperature = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = strtoul(argv[++i], nullptr, 0);
+        else if (!strcmp(argv[i], "--kv") && i + 1 < argc) kvType = parseKVType(argv[++i]);
+        else if (!strcmp(argv[i], "--no-grammar")) grammar = false;
+        else if (!strcmp(argv[i], "--draft")) speculative = GPT_SPEC_NGRAM;
+        else if (!strcmp(argv[i], "--draft-layers") && i + 1 < argc) {
+            speculative = GPT_SPEC_EARLY_EXIT;
+            draftLayers = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--workers") && i + 1 < argc) workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--w8a8")) w8a8 = true;
+        else if (!strcmp(argv[i], "--mmap")) mapped = true;
+        else if (!strcmp(argv[i], "--no-prefix")) prefixCache = false;
+        else if (!strcmp(argv[i], "--sessions") && i + 1 < argc) sessions = std::max(0, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--batch-curve") && i + 1 < argc) {
+            batchMax = std::min(GPT_BATCH_MAX, std::max(0, atoi(argv[++i])));
+        }
+        else if (!strcmp(argv[i], "--check-draft")) checkDraft = true;
+        else if (!strcmp(argv[i], "--runs") && i + 1 < argc) runs = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc) outPath = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) baselinePath = argv[++i];
+        else if (!strcmp(argv[i], "--threshold") && i + 1 < argc) thresholdPct = atof(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [--data DIR] [--prompt S] [--tokens N] [--temp T] [--seed S] [--runs N]\n"
+                            "          [--kv f32|f16|int8] [--no-grammar] [--draft] [--draft-layers N]\n"
+                            "          [--workers 1|2] [--w8a8] [--mmap] [--no-prefix] [--sessions N] [--batch-curve N]\n"
+                            "          [--check-draft] [--out FILE] [--baseline FILE] [--threshold PCT]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    Serial.setQuiet(true);
+    host_heap_reset_peak();
+    GPTModel model = {};
+    GPTSession session = {};
+    Clock::time_point loadStart = Clock::now();
+    bool loaded = mapped ? gpt_load_partition(&model, "model")
+                         : gpt_load(&model, "/model.bin");
+    if (!loaded || !gpt_session_init(&session, &model, kvType)) {
+        fprintf(stderr, "model load failed\n");
+        return 1;
+    }
+    double loadMs = ms(loadStart, Clock::now());
+    auto configure = [&](GPTSession* s) {
+        s->grammar = grammar;
+        s->speculative = speculative;
+        s->draft_layers = draftLayers;
+        s->w8a8 = w8a8;
+        s->prefix_cache = prefixCache;
+    };
+    configure(&session);
+    if (speculative == GPT_SPEC_NGRAM) buildDraftIndex(&model);
+    if (workers > 1) gpt_parallel_start(1);
+    size_t loadPeakSram = host_heap_peak(MALLOC_CAP_INTERNAL);
+    size_t loadPeakPsram = host_heap_peak(MALLOC_CAP_SPIRAM);
+
+    host_heap_reset_peak();
+    std::vector<RunStats> all;
+    for (int r = 0; r < runs; r++) {
+        gpt_prefix_clear(&session);
+        all.push_back(runOnce(&session, prompt, maxTokens, temperature, seed));
+    }
+    RunStats resumed = {};
+    if (prefixCache) resumed = runOnce(&session, prompt, maxTokens, temperature, seed);
+    size_t genPeakSram = host_heap_peak(MALLOC_CAP_INTERNAL);
+    size_t genPeakPsram = host_heap_peak(MALLOC_CAP_SPIRAM);
+    Accuracy acc = {};
+    if (w8a8) acc = compareW8A8(&session);
+    DraftCheck draftCheck = {};
+    if (checkDraft) draftCheck = checkDraftRestore(&model, &session, kvType, temperature, seed);
+
+    // Concurrent sessions on the shared weights, same seed as above
+    bool sessionsMatch = true;
+    double sessionsMs = 0.0;
+    int sessionsTokens = 0;
+    int sessionsWanted = sessions;
+    if (sessions > 0) {
+        // As many as the simulated SRAM/PSRAM budgets hold (an fp32 KV
+        // cache is 3 MB a session), like the firmware's GPT_SESSIONS
+        std::vector<GPTSession> extra(sessions);
+        for (int i = 0; i < sessions; i++) {
+            extra[i] = {};
+            if (!gpt_session_init(&extra[i], &model, kvType)) {
+                fprintf(stderr, "sessions: memory for %d of %d\n", i, sessions);
+                sessions = i;
+                break;
+            }
+            configure(&extra[i]);
+        }
+        std::vector<RunStats> results(sessions);
+        std::vector<std::thread> threads;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < sessions; i++) {
+            threads.emplace_back([&, i] {
+                results[i] = runOnce(&extra[i], prompt, maxTokens, temperature, seed);
+            });
+        }
+        for (std::thread& t : threads) t.join();
+        sessionsMs = ms(start, Clock::now());
+        for (int i = 0; i < sessions; i++) {
+            sessionsMatch &= results[i].outputHash == all[0].outputHash;
+            sessionsTokens += results[i].tokens;
+            gpt_session_free(&extra[i]);
+        }
+    }
+
+    std::vector<BatchPoint> curve;
+    bool batchMatch = true;
+    if (batchMax > 0) {
+        // The main session leads the pool; each session carries its own
+        // scratch, so the simulated SRAM budget may cap the batch size
+        session.speculative = GPT_SPEC_OFF;
+        std::vector<GPTSession*> pool = { &session };
+        while ((int)pool.size() < batchMax) {
+            GPTSession* s = new GPTSession();
+            if (!gpt_session_init(s, &model, kvType)) {
+                fprintf(stderr, "batch curve: memory for %zu sessions only\n", pool.size());
+                delete s;
+                break;
+            }
+            configure(s);
+            s->speculative = GPT_SPEC_OFF;
+            pool.push_back(s);
+        }
+        curve = runBatchCurve(pool, prompt, maxTokens, temperature, seed, &batchMatch);
+        for (size_t i = 1; i < pool.size(); i++) {
+            gpt_session_free(pool[i]);
+            delete pool[i];
+        }
+    }
+    gpt_parallel_stop();
+
+    // Report the median run by steady-state throughput
+    std::vector<RunStats> sorted = all;
+    std::sort(sorted.begin(), sorted.end(),
+              [](const RunStats& a, const RunStats& b) { return a.tokPerSec < b.tokPerSec; });
+    const RunStats& med = sorted[sorted.size() / 2];
+    bool deterministic = true;
+    for (const RunStats& s : all) deterministic &= s.outputHash == all[0].outputHash;
+    if (prefixCache) deterministic &= resumed.outputHash == all[0].outputHash;
+
+    FILE* out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) { perror(outPath); return 1; }
+    fprintf(out, "{\n  \"bench\": \"generate\",\n");
+    static const char* kvNames[] = { "f32", "f16", "int8" };
+    fprintf(out, "  \"prompt\": \"%s\", \"seed\": %u, \"temperature\": %.2f, \"runs\": %d, \"kv\": \"%s\",\n",
+            jsonEscape(prompt).c_str(), seed, temperature, runs, kvNames[kvType]);
+    fprintf(out, "  \"workers\": %d, \"w8a8\": %s,\n", workers > 1 ? GPT_PARALLEL_WORKERS : 1,
+            w8a8 ? "true" : "false");
+    if (w8a8) {
+        fprintf(out, "  \"w8a8_accuracy\": {\"tokens\": %d, \"top1_agreement\": %.4f, \"mean_kl\": %.5f, "
+                     "\"nll_fp32\": %.4f, \"nll_w8a8\": %.4f, \"max_logit_err\": %.3f},\n",
+                acc.tokens, acc.top1, acc.kl, acc.nllRef, acc.nll, acc.maxLogitErr);
+    }
+    fprintf(out, "  \"prompt_tokens\": %d, \"tokens\": %d, \"deterministic\": %s,\n",
+            med.promptTokens, med.tokens, deterministic ? "true" : "false");
+    fprintf(out, "  \"grammar\": %s, \"mml_valid\": %s,\n",
+            grammar ? "true" : "false", med.mmlValid ? "true" : "false");
+    static const char* specNames[] = { "off", "ngram", "early_exit" };
+    fprintf(out, "  \"speculative\": \"%s\", \"draft_layers\": %d, \"draft_proposed\": %u, \"draft_accepted\": %u,\n",
+            specNames[speculative], speculative == GPT_SPEC_EARLY_EXIT ? draftLayers : 0,
+            med.draftProposed, med.draftAccepted);
+    fprintf(out, "  \"acceptance\": %.3f, \"passes\": %u, \"tokens_per_pass\": %.2f,\n",
+            med.draftProposed ? (double)med.draftAccepted / med.draftProposed : 0.0, med.passes,
+            med.passes ? (double)med.tokens / med.passes : 0.0);
+    if (checkDraft) {
+        fprintf(out, "  \"draft_check\": {\"runs\": %d, \"mismatches\": %d, \"min_pos\": %d, \"dead_ends\": %d},\n",
+                draftCheck.runs, draftCheck.mismatches, draftCheck.minPos, draftCheck.deadEnds);
+    }
+    fprintf(out, "  \"load_ms\": %.2f, \"mmap\": %s,\n", loadMs, mapped ? "true" : "false");
+    fprintf(out, "  \"prefix_cache\": %s, \"prefix_reused\": %d, \"ttft_resumed_ms\": %.3f,\n",
+            prefixCache ? "true" : "false", resumed.prefixReused, resumed.ttftMs);
+    if (sessionsWanted > 0) {
+        fprintf(out, "  \"sessions\": %d, \"sessions_requested\": %d, \"sessions_match\": %s, "
+                     "\"sessions_ms\": %.2f, \"sessions_tokens_per_sec\": %.2f,\n",
+                sessions, sessionsWanted, sessionsMatch ? "true" : "false", sessionsMs,
+                sessionsMs > 0 ? sessionsTokens * 1000.0 / sessionsMs : 0.0);
+    }
+    if (!curve.empty()) {
+        fprintf(out, "  \"batch_match\": %s, \"batch_curve\": [", batchMatch ? "true" : "false");
+        for (size_t i = 0; i < curve.size(); i++) {
+            const BatchPoint& p = curve[i];
+            fprintf(out, "%s\n    {\"batch\": %d, \"tokens\": %d, \"ms\": %.2f, \"tokens_per_sec\": %.2f, "
+                         "\"speedup\": %.2f}",
+                    i ? "," : "", p.batch, p.tokens, p.ms, p.tokPerSec, p.tokPerSec / curve[0].tokPerSec);
+        }
+        fprintf(out, "\n  ],\n");
+    }
+    fprintf(out, "  \"ttft_ms\": %.3f,\n", med.ttftMs);
+    fprintf(out, "  \"total_ms\": %.2f,\n", med.totalMs);
+    fprintf(out, "  \"tokens_per_sec\": %.2f,\n", med.tokPerSec);
+    fprintf(out, "  \"buckets\": [");
+    for (size_t b = 0; b < med.bucketTps.size(); b++) {
+        fprintf(out, "%s\n    {\"pos\": \"%d-%d\", \"tokens\": %d, \"tokens_per_sec\": %.2f}",
+                b ? "," : "", (int)b * BUCKET, (int)(b + 1) * BUCKET - 1,
+                med.bucketTokens[b], med.bucketTps[b]);
+    }
+    fprintf(out, "\n  ],\n");
+    fprintf(out, "  \"peak_sram_load\": %zu, \"peak_psram_load\": %zu,\n", loadPeakSram, loadPeakPsram);
+    fprintf(out, "  \"peak_sram\": %zu, \"peak_psram\": %zu\n}\n", genPeakSram, genPeakPsram);
+    if (out != stdout) fclose(out);
+
+    gpt_session_free(&session);
+    gpt_free(&model);
+
+    if (!baselinePath) return sessionsMatch && batchMatch && !draftCheck.mismatches ? 0 : 1;
+
+    double baseTps = 0.0, baseTtft = 0.0;
+    if (!readBaseline(baselinePath, "tokens_per_sec", &baseTps) ||
+        !readBaseline(baselinePath, "ttft_ms", &baseTtft)) {
+        fprintf(stderr, "could not read baseline %s\n", baselinePath);
+        return 1;
+    }
+    bool failed = false;
+    double tpsDelta = (med.tokPerSec - baseTps) * 100.0 / baseTps;
+    double ttftDelta = baseTtft > 0.0 ? (med.ttftMs - baseTtft) * 100.0 / baseTtft : 0.0;
+    fprintf(stderr, "tokens/sec %.2f -> %.2f (%+.1f%%), ttft %.3f -> %.3f ms (%+.1f%%)\n",
+            baseTps, med.tokPerSec, tpsDelta, baseTtft, med.ttftMs, ttftDelta);
+    if (tpsDelta < -thresholdPct) {
+        fprintf(stderr, "REGRESSION: tokens/sec dropped more than %.1f%%\n", thresholdPct);
+        failed = true;
+    }
+    if (ttftDelta > thresholdPct && med.ttftMs - baseTtft > TTFT_FLOOR_MS) {
+        fprintf(stderr, "REGRESSION: time-to-first-token grew more than %.1f%% and %.1f ms\n",
+                thresholdPct, TTFT_FLOOR_MS);
+        failed = true;
+    }
+    return failed || !sessionsMatch || !batchMatch || draftCheck.mismatches ? 1 : 0;
+}
@@ -0,0 +1,438 @@
+// Kernel microbenchmarks at the shapes of data/model.bin
+// (n_embd=128, n_layer=6, n_head=4, block_size=512, vocab=650).
+// Writes one JSON document with ns/op and effective GB/s per kernel so
+// rewrites can be compared across commits. Before timing anything it
+// checks the SIMD dot-product kernels against their scalar references at
+// every model shape and exits non-zero on any bit difference:
+//
+//   bench_kernels [--out FILE] [--min-ms N] [--attn-step N]
+
+#include <Arduino.h>
+#include "gpt_kernels.h"
+#include "gpt_simd.h"
+#include "mini_gpt.h"
+#include <chrono>
+#include <vector>
+
+static const int N_EMBD = 128;
+static const int N_HEAD = 4;
+static const int HEAD_DIM = N_EMBD / N_HEAD;
+static const int BLOCK_SIZE = 512;
+static const int VOCAB = 650;
+
+static double minMs = 50.0;
+static volatile float sink;
+
+// Deterministic fill so runs are comparable
+static uint32_t lcgState = 12345;
+static uint32_t lcg() {
+    lcgState = lcgState * 1664525u + 1013904223u;
+    return lcgState;
+}
+static void fillFloat(std::vector<float>& v, float scale) {
+    for (float& x : v) x = ((int)(lcg() >> 9 & 0xFFFF) - 32768) * (scale / 32768.0f);
+}
+static void fillInt8(std::vector<int8_t>& v) {
+    for (int8_t& x : v) x = (int8_t)(lcg() >> 24);
+}
+
+// Run fn repeatedly for at least minMs and return ns per call
+template <typename Fn>
+static double timeNs(Fn fn) {
+    using clk = std::chrono::steady_clock;
+    for (int i = 0; i < 3; i++) fn();  // warm-up
+    long iters = 0;
+    auto start = clk::now();
+    double elapsedNs = 0.0;
+    long batch = 1;
+    while (elapsedNs < minMs * 1e6) {
+        for (long i = 0; i < batch; i++) fn();
+        iters += batch;
+        elapsedNs = std::chrono::duration<double, std::nano>(clk::now() - start).count();
+        if (batch < (1 << 20)) batch *= 2;
+    }
+    return elapsedNs / iters;
+}
+
+static FILE* out = stdout;
+static bool firstResult = true;
+
+static void report(const char* name, const char* shapeKey, const char* shape,
+                   int pos, double ns, double bytes) {
+    fprintf(out, "%s\n    {\"kernel\": \"%s\", ", firstResult ? "" : ",", name);
+    if (shapeKey) fprintf(out, "\"%s\": \"%s\", ", shapeKey, shape);
+    if (pos >= 0) fprintf(out, "\"pos\": %d, ", pos);
+    fprintf(out, "\"ns_per_op\": %.1f, \"gb_per_s\": %.3f}", ns, bytes / ns);
+    firstResult = false;
+}
+
+// ---------- SIMD vs scalar reference ----------
+
+static int mismatches = 0;
+
+static void expectSame(const char* what, int rows, int cols, int n, const void* got,
+                       const void* want, size_t bytes) {
+    if (memcmp(got, want, bytes) == 0) return;
+    fprintf(stderr, "SIMD mismatch: %s %dx%d n=%d\n", what, rows, cols, n);
+    mismatches++;
+}
+
+// matmul_int8 and every batch size up to a prefill chunk against
+// dot_i8_f32_ref, plus dot_i8_i8 and the int4 dots (n = group size in
+// the mismatch report) on each weight row
+static void checkShape(int rows, int cols) {
+    const int maxN = GPT_PREFILL_CHUNK;
+    std::vector<float> in((size_t)maxN * cols), scales(rows);
+    std::vector<float> got((size_t)maxN * rows), want((size_t)maxN * rows);
+    std::vector<int8_t> w((size_t)rows * cols), a(cols);
+    fillFloat(in, 1.0f);
+    fillFloat(scales, 0.01f);
+    fillInt8(w);
+    fillInt8(a);
+
+    for (int i = 0; i < maxN; i++) {
+        for (int r = 0; r < rows; r++) {
+            want[(size_t)i * rows + r] =
+                dot_i8_f32_ref(w.data() + (size_t)r * cols, in.data() + (size_t)i * cols, cols) * scales[r];
+        }
+    }
+    matmul_int8(got.data(), in.data(), w.data(), scales.data(), rows, cols);
+    expectSame("matmul_int8", rows, cols, 1, got.data(), want.data(), rows * sizeof(float));
+    for (int n = 1; n <= maxN; n++) {
+        matmul_int8_batch(got.data(), in.data(), w.data(), scales.data(), rows, cols, n);
+        expectSame("matmul_int8_batch", rows, cols, n, got.data(), want.data(),
+                   (size_t)n * rows * sizeof(float));
+    }
+
+    for (int r = 0; r < rows; r++) {
+        int32_t g = dot_i8_i8(w.data() + (size_t)r * cols, a.data(), cols);
+        int32_t e = dot_i8_i8_ref(w.data() + (size_t)r * cols, a.data(), cols);
+        expectSame("dot_i8_i8", rows, cols, 1, &g, &e, sizeof(g));
+    }
+
+    // The int8 weights reinterpreted as packed int4 rows, every group size
+    std::vector<uint16_t> q4Scales(cols / 16);
+    for (uint16_t& h : q4Scales) h = fp32_to_fp16(0.01f + (lcg() >> 24) * 1e-4f);
+    for (int group = 16; group <= GPT_Q4_GROUP_MAX && cols % group == 0; group *= 2) {
+        for (int r = 0; r < rows / 2; r++) {
+            const uint8_t* packed = (const uint8_t*)w.data() + (size_t)r * cols;
+            float g = dot_q4_f32(packed, q4Scales.data(), group, in.data(), cols);
+            float e = dot_q4_f32_ref(packed, q4Scales.data(), group, in.data(), cols);
+            expectSame("dot_q4_f32", rows, cols, group, &g, &e, sizeof(g));
+            g = dot_q4_i8(packed, q4Scales.data(), group, a.data(), cols);
+            e = dot_q4_i8_ref(packed, q4Scales.data(), group, a.data(), cols);
+            expectSame("dot_q4_i8", rows, cols, group, &g, &e, sizeof(g));
+        }
+    }
+}
+
+// Lengths that exercise the scalar tails and unaligned starts
+static void checkTails() {
+    std::vector<float> x(64 + 3);
+    std::vector<int8_t> w(64 + 3), b(64 + 3);
+    fillFloat(x, 1.0f);
+    fillInt8(w);
+    fillInt8(b);
+    for (int n = 0; n <= 64; n++) {
+        for (int off = 0; off < 3; off++) {
+            float g = dot_i8_f32(w.data() + off, x.data() + off, n);
+            float e = dot_i8_f32_ref(w.data() + off, x.data() + off, n);
+            expectSame("dot_i8_f32", 1, n, off, &g, &e, sizeof(g));
+            int32_t gi = dot_i8_i8(w.data() + off, b.data(), n);
+            int32_t ei = dot_i8_i8_ref(w.data() + off, b.data(), n);
+            expectSame("dot_i8_i8", 1, n, off, &gi, &ei, sizeof(gi));
+        }
+    }
+}
+
+static void benchDot(int n) {
+    std::vector<float> x(n);
+    std::vector<int8_t> w(n), b(n);
+    fillFloat(x, 1.0f);
+    fillInt8(w);
+    fillInt8(b);
+    char shape[16];
+    snprintf(shape, sizeof(shape), "%d", n);
+    double bytes = n * (1.0 + sizeof(float));
+    report("dot_i8_f32_ref", "n", shape, -1, timeNs([&] { sink = dot_i8_f32_ref(w.data(), x.data(), n); }), bytes);
+    report("dot_i8_f32", "n", shape, -1, timeNs([&] { sink = dot_i8_f32(w.data(), x.data(), n); }), bytes);
+    report("dot_i8_i8_ref", "n", shape, -1, timeNs([&] { sink = (float)dot_i8_i8_ref(w.data(), b.data(), n); }), 2.0 * n);
+    report("dot_i8_i8", "n", shape, -1, timeNs([&] { sink = (float)dot_i8_i8(w.data(), b.data(), n); }), 2.0 * n);
+}
+
+static void benchMatmul(int rows, int cols) {
+    std::vector<float> in(cols), scales(rows), o(rows);
+    std::vector<int8_t> w((size_t)rows * cols);
+    fillFloat(in, 1.0f);
+    fillFloat(scales, 0.01f);
+    fillInt8(w);
+    double ns = timeNs([&] {
+        matmul_int8(o.data(), in.data(), w.data(), scales.data(), rows, cols);
+        sink = o[0];
+    });
+    double bytes = (double)rows * cols + (cols + 2.0 * rows) * sizeof(float);
+    char shape[32];
+    snprintf(shape, sizeof(shape), "%dx%d", rows, cols);
+    report("matmul_int8", "shape", shape, -1, ns, bytes);
+}
+
+// matmul_int8 with the input quantized to int8 first (W8A8 decode step)
+static void benchMatmulW8A8(int rows, int cols) {
+    std::vector<float> in(cols), scales(rows), o(rows);
+    std::vector<int8_t> w((size_t)rows * cols), xq(cols);
+    fillFloat(in, 1.0f);
+    fillFloat(scales, 0.01f);
+    fillInt8(w);
+    float xScale;
+    double ns = timeNs([&] {
+        quantize_rows_q8(xq.data(), &xScale, in.data(), cols, 1);
+        matmul_w8a8_rows(o.data(), xq.data(), &xScale, w.data(), scales.data(), rows, cols, 1, 0, rows);
+        sink = o[0];
+    });
+    double bytes = (double)rows * cols + cols * (1.0 + sizeof(float)) + 2.0 * rows * sizeof(float);
+    char shape[32];
+    snprintf(shape, sizeof(shape), "%dx%d", rows, cols);
+    report("matmul_w8a8", "shape", shape, -1, ns, bytes);
+}
+
+// INT4 weights (group 32, fp16 scales), fp32 or quantized input
+static void benchMatmulQ4(int rows, int cols, bool w8a8) {
+    const int group = 32;
+    std::vector<float> in(cols), o(rows);
+    std::vector<int8_t> packed((size_t)rows * cols / 2), xq(cols);
+    std::vector<uint16_t> scales((size_t)rows * (cols / group));
+    fillFloat(in, 1.0f);
+    fillInt8(packed);
+    for (uint16_t& h : scales) h = fp32_to_fp16(0.01f + (lcg() >> 24) * 1e-4f);
+    const uint8_t* w = (const uint8_t*)packed.data();
+    float xScale;
+    double ns = timeNs([&] {
+        if (w8a8) {
+            quantize_rows_q8(xq.data(), &xScale, in.data(), cols, 1);
+            matmul_q4_w8a8_rows(o.data(), xq.data(), &xScale, w, scales.data(), group, rows, cols, 1, 0, rows);
+        } else {
+            matmul_q4_rows(o.data(), in.data(), w, scales.data(), group, rows, cols, 1, 0, rows);
+        }
+        sink = o[0];
+    });
+    double bytes = packed.size() + scales.size() * sizeof(uint16_t) +
+                   cols * (w8a8 ? 1.0 + sizeof(float) : sizeof(float)) + rows * sizeof(float);
+    char shape[32];
+    snprintf(shape, sizeof(shape), "%dx%d", rows, cols);
+    report(w8a8 ? "matmul_q4_w8a8" : "matmul_q4", "shape", shape, -1, ns, bytes);
+}
+
+// n activation rows against one weight matrix, as in a prefill chunk
+static void benchMatmulBatch(int rows, int cols, int n) {
+    std::vector<float> in((size_t)n * cols), scales(rows), o((size_t)n * rows);
+    std::vector<int8_t> w((size_t)rows * cols);
+    fillFloat(in, 1.0f);
+    fillFloat(scales, 0.01f);
+    fillInt8(w);
+    double ns = timeNs([&] {
+        matmul_int8_batch(o.data(), in.data(), w.data(), scales.data(), rows, cols, n);
+        sink = o[0];
+    });
+    double bytes = (double)rows * cols + (n * (cols + rows) + rows) * sizeof(float);
+    char shape[32];
+    snprintf(shape, sizeof(shape), "%dx%dx%d", rows, cols, n);
+    report("matmul_int8_batch", "shape", shape, -1, ns, bytes);
+}
+
+static void benchRmsnorm(int n) {
+    std::vector<float> x(n), g(n), o(n);
+    fillFloat(x, 1.0f);
+    fillFloat(g, 1.0f);
+    double ns = timeNs([&] {
+        rmsnorm(o.data(), x.data(), g.data(), n);
+        sink = o[0];
+    });
+    char shape[16];
+    snprintf(shape, sizeof(shape), "%d", n);
+    report("rmsnorm", "n", shape, -1, ns, 3.0 * n * sizeof(float));
+}
+
+static void benchSoftmax(int n) {
+    std::vector<float> src(n), x(n);
+    fillFloat(src, 4.0f);
+    double ns = timeNs([&] {
+        memcpy(x.data(), src.data(), n * sizeof(float));
+        softmax(x.data(), n);
+        sink = x[0];
+    });
+    char shape[16];
+    snprintf(shape, sizeof(shape), "%d", n);
+    report("softmax", "n", shape, -1, ns, 2.0 * n * sizeof(float));
+}
+
+// One layer's K/V cache slice in the head-major layout used by
+// gpt_forward ([n_head][block_size][head_dim]), the same data in each
+// reduced-precision KV storage mode, and a token-major fp32 copy
+// ([block_size][n_embd]) for comparison with the previous layout
+static std::vector<float> kCache, vCache, kTokenMajor, vTokenMajor, q, att, headOut;
+static std::vector<uint16_t> kCacheF16, vCacheF16;
+static std::vector<int8_t> kCacheQ8, vCacheQ8;
+static std::vector<float> kScale, vScale;
+static std::vector<float> tile(GPT_ATT_TILE * HEAD_DIM);
+
+static void buildCaches() {
+    size_t n = kCache.size();
+    kTokenMajor.resize(n);
+    vTokenMajor.resize(n);
+    for (int h = 0; h < N_HEAD; h++) {
+        for (int t = 0; t < BLOCK_SIZE; t++) {
+            size_t src = ((size_t)h * BLOCK_SIZE + t) * HEAD_DIM;
+            size_t dst = (size_t)t * N_EMBD + h * HEAD_DIM;
+            memcpy(&kTokenMajor[dst], &kCache[src], HEAD_DIM * sizeof(float));
+            memcpy(&vTokenMajor[dst], &vCache[src], HEAD_DIM * sizeof(float));
+        }
+    }
+
+    kCacheF16.resize(n);
+    vCacheF16.resize(n);
+    kv_store_f16(kCacheF16.data(), kCache.data(), (int)n);
+    kv_store_f16(vCacheF16.data(), vCache.data(), (int)n);
+
+    kCacheQ8.resize(n);
+    vCacheQ8.resize(n);
+    kScale.resize(N_HEAD * BLOCK_SIZE);
+    vScale.resize(N_HEAD * BLOCK_SIZE);
+    for (int row = 0; row < N_HEAD * BLOCK_SIZE; row++) {
+        size_t off = (size_t)row * HEAD_DIM;
+        kv_store_q8(kCacheQ8.data() + off, &kScale[row], kCache.data() + off, HEAD_DIM);
+        kv_store_q8(vCacheQ8.data() + off, &vScale[row], vCache.data() + off, HEAD_DIM);
+    }
+}
+
+static void reportAttention(const char* kv, const char* layout, int pos, double ns, double bytes) {
+    fprintf(out, "%s\n    {\"kernel\": \"attention\", \"kv\": \"%s\", \"layout\": \"%s\", "
+                 "\"pos\": %d, \"ns_per_op\": %.1f, \"gb_per_s\": %.3f}",
+            firstResult ? "" : ",", kv, layout, pos, ns, bytes / ns);
+    firstResult = false;
+}
+
+static void benchAttention(int pos) {
+    const size_t headStride = (size_t)BLOCK_SIZE * HEAD_DIM;
+
+    // Previous layout: token-major rows, untiled
+    double ns = timeNs([&] {
+        for (int h = 0; h < N_HEAD; h++) {
+            attention_head(headOut.data() + h * HEAD_DIM, q.data() + h * HEAD_DIM,
+                           kTokenMajor.data() + h * HEAD_DIM, vTokenMajor.data() + h * HEAD_DIM,
+                           att.data() + h * BLOCK_SIZE, pos, HEAD_DIM, N_EMBD);
+        }
+        sink = headOut[0];
+    });
+    // K and V rows actually read for all heads
+    double bytes = 2.0 * (pos + 1) * N_EMBD * sizeof(float);
+    reportAttention("f32", "token", pos, ns, bytes);
+
+    ns = timeNs([&] {
+        for (int h = 0; h < N_HEAD; h++) {
+            attention_head(headOut.data() + h * HEAD_DIM, q.data() + h * HEAD_DIM,
+                           kCache.data() + h * headStride, vCache.data() + h * headStride,
+                           att.data() + h * BLOCK_SIZE, pos, HEAD_DIM, HEAD_DIM, tile.data());
+        }
+        sink = headOut[0];
+    });
+    reportAttention("f32", "head", pos, ns, bytes);
+
+    ns = timeNs([&] {
+        for (int h = 0; h < N_HEAD; h++) {
+            attention_head_f16(headOut.data() + h * HEAD_DIM, q.data() + h * HEAD_DIM,
+                               kCacheF16.data() + h * headStride, vCacheF16.data() + h * headStride,
+                               att.data() + h * BLOCK_SIZE, pos, HEAD_DIM, HEAD_DIM, tile.data());
+        }
+        sink = headOut[0];
+    });
+    reportAttention("f16", "head", pos, ns, 2.0 * (pos + 1) * N_EMBD * sizeof(uint16_t));
+
+    ns = timeNs([&] {
+        for (int h = 0; h < N_HEAD; h++) {
+            attention_head_q8(headOut.data() + h * HEAD_DIM, q.data() + h * HEAD_DIM,
+                              kCacheQ8.data() + h * headStride, kScale.data() + h * BLOCK_SIZE,
+                              vCacheQ8.data() + h * headStride, vScale.data() + h * BLOCK_SIZE,
+                              att.data() + h * BLOCK_SIZE, pos, HEAD_DIM, HEAD_DIM, 1, tile.data());
+        }
+        sink = headOut[0];
+    });
+    reportAttention("int8", "head", pos, ns,
+                    2.0 * (pos + 1) * (N_EMBD + N_HEAD * sizeof(float)));
+}
+
+int main(int argc, char** argv) {
+    int attnStep = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+            out = fopen(argv[++i], "w");
+            if (!out) { perror(argv[i]); return 1; }
+        } else if (!strcmp(argv[i], "--min-ms") && i + 1 < argc) {
+            minMs = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--attn-step") && i + 1 < argc) {
+            attnStep = atoi(argv[++i]);
+            if (attnStep < 1) attnStep = 1;
+        } else {
+            fprintf(stderr, "usage: %s [--out FILE] [--min-ms N] [--attn-step N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    kCache.resize((size_t)BLOCK_SIZE * N_EMBD);
+    vCache.resize((size_t)BLOCK_SIZE * N_EMBD);
+    q.resize(N_EMBD);
+    att.resize(N_HEAD * BLOCK_SIZE);
+    headOut.resize(N_EMBD);
+    fillFloat(kCache, 1.0f);
+    fillFloat(vCache, 1.0f);
+    fillFloat(q, 1.0f);
+    buildCaches();
+
+    checkShape(N_EMBD, N_EMBD);
+    checkShape(4 * N_EMBD, N_EMBD);
+    checkShape(N_EMBD, 4 * N_EMBD);
+    checkShape(VOCAB, N_EMBD);
+    checkTails();
+    if (!gpt_simd_check()) {
+        fprintf(stderr, "SIMD mismatch: gpt_simd_check\n");
+        mismatches++;
+    }
+
+    fprintf(out, "{\n  \"bench\": \"kernels\",\n  \"simd\": \"%s\",\n  \"simd_mismatches\": %d,\n"
+                 "  \"results\": [", gpt_simd_name(), mismatches);
+    if (mismatches) {
+        fprintf(out, "\n  ]\n}\n");
+        if (out != stdout) fclose(out);
+        return 1;
+    }
+
+    benchDot(N_EMBD);
+    benchDot(4 * N_EMBD);
+    benchMatmul(N_EMBD, N_EMBD);          // Q/K/V/O
+    benchMatmul(4 * N_EMBD, N_EMBD);      // MLP up
+    benchMatmul(N_EMBD, 4 * N_EMBD);      // MLP down
+    benchMatmul(VOCAB, N_EMBD);           // LM head
+    benchMatmulW8A8(N_EMBD, N_EMBD);
+    benchMatmulW8A8(4 * N_EMBD, N_EMBD);
+    benchMatmulW8A8(N_EMBD, 4 * N_EMBD);
+    benchMatmulQ4(N_EMBD, N_EMBD, false);
+    benchMatmulQ4(4 * N_EMBD, N_EMBD, false);
+    benchMatmulQ4(N_EMBD, 4 * N_EMBD, false);
+    benchMatmulQ4(VOCAB, N_EMBD, false);
+    benchMatmulQ4(4 * N_EMBD, N_EMBD, true);
+    benchMatmulBatch(N_EMBD, N_EMBD, GPT_PREFILL_CHUNK);
+    benchMatmulBatch(4 * N_EMBD, N_EMBD, GPT_PREFILL_CHUNK);
+    benchRmsnorm(N_EMBD);
+    benchSoftmax(VOCAB);
+    benchSoftmax(BLOCK_SIZE);
+
+    // Attention minimum-time budget is per position; keep the sweep short
+    double savedMs = minMs;
+    minMs = savedMs / 10.0;
+    for (int pos = 1; pos < BLOCK_SIZE; pos += attnStep) benchAttention(pos);
+    if ((BLOCK_SIZE - 2) % attnStep != 0) benchAttention(BLOCK_SIZE - 1);
+    minMs = savedMs;
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) fclose(out);
+    return 0;
+}
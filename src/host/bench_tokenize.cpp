@@ -0,0 +1,122 @@
+// Prompt encoder benchmark: tokenizes every MML string in songs.h with
+// gpt_encode and with the original greedy scan (every length 16..1 against
+// every vocab entry), checks both produce the same tokens and reports
+// ns/char for each as JSON. Exits non-zero on any mismatch.
+//
+//   bench_tokenize [--data DIR] [--out FILE] [--min-ms N]
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "mini_gpt.h"
+#include "songs.h"
+#include <chrono>
+#include <vector>
+
+static double minMs = 200.0;
+static volatile int sink;
+
+// The encoder gpt_generate used before the trie, kept as the reference
+static int encodeReference(const GPTModel* model, const char* text, int* out, int max_out) {
+    int n = 0;
+    const char* p = text;
+    while (*p && n < max_out) {
+        bool found = false;
+        for (int len = GPT_TOKEN_MATCH_MAX; len > 0; len--) {
+            if (p + len > text + strlen(text)) continue;
+            for (int i = 0; i < model->config.vocab_size; i++) {
+                if (strncmp(p, model->tokenMap.tokens[i], len) == 0 &&
+                    strlen(model->tokenMap.tokens[i]) == (size_t)len) {
+                    out[n++] = i;
+                    p += len;
+                    found = true;
+                    break;
+                }
+            }
+            if (found) break;
+        }
+        if (!found) p++;
+    }
+    return n;
+}
+
+// Encode the whole corpus repeatedly for at least minMs; returns ns per pass
+template <typename Fn>
+static double timeCorpusNs(Fn fn) {
+    using clk = std::chrono::steady_clock;
+    fn();  // warm-up
+    long passes = 0;
+    auto start = clk::now();
+    double elapsedNs = 0.0;
+    while (elapsedNs < minMs * 1e6) {
+        fn();
+        passes++;
+        elapsedNs = std::chrono::duration<double, std::nano>(clk::now() - start).count();
+    }
+    return elapsedNs / passes;
+}
+
+int main(int argc, char** argv) {
+    const char* outPath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--data") && i + 1 < argc) LittleFS.setRoot(argv[++i]);
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc) outPath = argv[++i];
+        else if (!strcmp(argv[i], "--min-ms") && i + 1 < argc) minMs = atof(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [--data DIR] [--out FILE] [--min-ms N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Serial.setQuiet(true);
+    GPTModel model = {};
+    if (!gpt_load(&model, "/model.bin")) {
+        fprintf(stderr, "model load failed\n");
+        return 1;
+    }
+
+    std::vector<const SongDef*> songs;
+    size_t chars = 0, longest = 0;
+    for (uint16_t i = 0; i < SONG_DEF_COUNT; i++) {
+        if (songDefs[i].fmt != FMT_MML) continue;
+        songs.push_back(&songDefs[i]);
+        size_t len = strlen(songDefs[i].str);
+        chars += len;
+        if (len > longest) longest = len;
+    }
+
+    // Correctness first: both encoders must agree on every song
+    std::vector<int> a(longest + 1), b(longest + 1);
+    int mismatches = 0;
+    long tokens = 0;
+    for (const SongDef* s : songs) {
+        int na = gpt_encode(&model, s->str, a.data(), (int)longest);
+        int nb = encodeReference(&model, s->str, b.data(), (int)longest);
+        tokens += na;
+        if (na != nb || memcmp(a.data(), b.data(), na * sizeof(int)) != 0) {
+            fprintf(stderr, "MISMATCH %s: trie %d tokens, reference %d tokens\n", s->name, na, nb);
+            mismatches++;
+        }
+    }
+
+    double trieNs = timeCorpusNs([&] {
+        for (const SongDef* s : songs) sink = gpt_encode(&model, s->str, a.data(), (int)longest);
+    });
+    double refNs = timeCorpusNs([&] {
+        for (const SongDef* s : songs) sink = encodeReference(&model, s->str, b.data(), (int)longest);
+    });
+
+    FILE* out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) { perror(outPath); return 1; }
+    fprintf(out, "{\n  \"bench\": \"tokenize\",\n");
+    fprintf(out, "  \"songs\": %zu, \"chars\": %zu, \"tokens\": %ld, \"longest_chars\": %zu,\n",
+            songs.size(), chars, tokens, longest);
+    fprintf(out, "  \"trie_nodes\": %d, \"mismatches\": %d,\n", model.tokenMap.trie_nodes, mismatches);
+    fprintf(out, "  \"trie_ns_per_char\": %.2f, \"reference_ns_per_char\": %.2f,\n",
+            trieNs / chars, refNs / chars);
+    fprintf(out, "  \"trie_corpus_ms\": %.3f, \"reference_corpus_ms\": %.3f, \"speedup\": %.1f\n}\n",
+            trieNs / 1e6, refNs / 1e6, refNs / trieNs);
+    if (out != stdout) fclose(out);
+
+    gpt_free(&model);
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+// Host driver for the native build: loads data/model.bin through the
+// LittleFS shim, generates a melody and runs it through parseMML and the
+// MelodyPlayer sequencing logic on a simulated clock. --mmap maps
+// DIR/model.bin as the "model" flash partition instead. --plan only
+// prints the memory layout gpt_load and one session would allocate. --prefix
+// loads prompt snapshots from DIR/FILE first and saves them back after.
+//
+//   gpt_cli [--data DIR] [--prompt S] [--tokens N] [--temp T] [--seed S]
+//           [--kv f32|f16|int8] [--no-grammar] [--draft] [--draft-layers N]
+//           [--workers 1|2] [--w8a8] [--mmap] [--plan] [--prefix FILE] [--songs]
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "config.h"
+#include "songs.h"
+#include "mini_gpt.h"
+#include "music.h"
+#include "player.h"
+#include <csignal>
+#include <vector>
+
+// Ctrl-C cancels the running generation, like gen:stop on the device
+static volatile bool cancelRequested = false;
+static void onSigint(int) { cancelRequested = true; }
+
+// Play one parsed track to completion on the manual clock.
+// Returns the simulated playback time in ms.
+static unsigned long simulateTrack(const uint16_t (*notes)[2], uint16_t length) {
+    MelodyPlayer p = {};
+    p.melody = notes;
+    p.length = length;
+    p.ledcChannel = 0;
+    p.playing = true;
+    hostSetClock(0);
+    p.noteStartedAt = 0;
+    setupNote(p);
+
+    unsigned long now = 0;
+    while (!p.inLoopPause) {
+        now++;
+        hostSetClock(now);
+        updatePlayer(p);
+    }
+    hostUseWallClock();
+    return now;
+}
+
+// Parse an MML/RTTTL string and sequence every track, checking that the
+// player's timing agrees with the parsed durations.
+static bool checkSong(const char* str, SongFmt fmt, const char* name, bool verbose) {
+    static uint16_t notes[MAX_NOTES_PER_SONG][2];
+    uint8_t tracks = fmt == FMT_MML ? countMMLTracks(str) : 1;
+    if (tracks > MAX_TRACKS) tracks = MAX_TRACKS;
+
+    bool ok = true;
+    uint16_t parsedTracks = 0;
+    for (uint8_t t = 0; t < tracks; t++) {
+        uint16_t count = fmt == FMT_MML
+            ? parseMML(str, notes, MAX_NOTES_PER_SONG, t)
+            : parseRTTTL(str, notes, MAX_NOTES_PER_SONG);
+        if (count == 0) continue;
+        parsedTracks++;
+
+        unsigned long expected = 0;
+        for (uint16_t n = 0; n < count; n++) expected += notes[n][1];
+        unsigned long played = simulateTrack(notes, count);
+        if (played != expected) {
+            printf("MISMATCH %s track %d: parsed %lums, played %lums\n", name, t, expected, played);
+            ok = false;
+        }
+        if (verbose) printf("  track %d: %d notes, %lums\n", t, count, played);
+    }
+    if (parsedTracks == 0) {
+        printf("EMPTY %s\n", name);
+        ok = false;
+    }
+    return ok;
+}
+
+static int runSongs() {
+    Serial.setQuiet(true);
+    int failures = 0;
+    for (uint16_t i = 0; i < SONG_DEF_COUNT; i++) {
+        if (!checkSong(songDefs[i].str, songDefs[i].fmt, songDefs[i].name, false)) failures++;
+    }
+    printf("songs: %d checked, %d failed\n", SONG_DEF_COUNT, failures);
+    return failures == 0 ? 0 : 1;
+}
+
+static void printToken(const char* token, void*) {
+    fputs(token, stdout);
+    fflush(stdout);
+}
+
+static GPTKVType parseKVType(const char* name) {
+    if (!strcmp(name, "f16")) return GPT_KV_F16;
+    if (!strcmp(name, "int8")) return GPT_KV_INT8;
+    return GPT_KV_F32;
+}
+
+// Arena layout for DIR/model.bin without loading its weights
+static int runPlan(GPTKVType kvType) {
+    File f = LittleFS.open("/model.bin", "r");
+    if (!f) {
+        fprintf(stderr, "cannot open model.bin\n");
+        return 1;
+    }
+    std::vector<uint8_t> data(f.size());
+    size_t got = f.read(data.data(), data.size());
+    f.close();
+
+    GPTFileInfo info;
+    if (!gpt_read_header(data.data(), got, &info)) return 1;
+    GPTMemoryPlan plan;
+    gpt_plan_memory(info.config, kvType, info.token_chars, &plan);
+    gpt_plan_print(plan);
+    return 0;
+}
+
+// Draft corpus: the built-in MML songs, as on the device
+static void buildDraftIndex(GPTModel* model) {
+    std::vector<const char*> texts;
+    for (uint16_t i = 0; i < SONG_DEF_COUNT; i++) {
+        if (songDefs[i].fmt == FMT_MML) texts.push_back(songDefs[i].str);
+    }
+    gpt_draft_build(model, texts.data(), (int)texts.size());
+}
+
+int main(int argc, char** argv) {
+    const char* prompt = "MML@";
+    int maxTokens = 900;
+    float temperature = 0.8f;
+    GPTKVType kvType = GPT_KV_F32;
+    uint32_t seed = 0;
+    bool grammar = true;
+    GPTSpecMode speculative = GPT_SPEC_OFF;
+    int draftLayers = 2;
+    int workers = 1;
+    bool w8a8 = false;
+    bool mapped = false;
+    bool plan = false;
+    const char* prefixFile = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--data") && i + 1 < argc) LittleFS.setRoot(argv[++i]);
+        else if (!strcmp(argv[i], "--prompt") && i + 1 < argc) prompt = argv[++i];
+        else if (!strcmp(argv[i], "--tokens") && i + 1 < argc) maxTokens = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--temp") && i + 1 < argc) temperature = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = strtoul(argv[++i], nullptr, 0);
+        else if (!strcmp(argv[i], "--kv") && i + 1 < argc) kvType = parseKVType(argv[++i]);
+        else if (!strcmp(argv[i], "--no-grammar")) grammar = false;
+        else if (!strcmp(argv[i], "--draft")) speculative = GPT_SPEC_NGRAM;
+        else if (!strcmp(argv[i], "--draft-layers") && i + 1 < argc) {
+            speculative = GPT_SPEC_EARLY_EXIT;
+            draftLayers = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--workers") && i + 1 < argc) workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--w8a8")) w8a8 = true;
+        else if (!strcmp(argv[i], "--mmap")) mapped = true;
+        else if (!strcmp(argv[i], "--plan")) plan = true;
+        else if (!strcmp(argv[i], "--prefix") && i + 1 < argc) prefixFile = argv[++i];
+        else if (!strcmp(argv[i], "--songs")) return runSongs();
+        else {
+            fprintf(stderr, "usage: %s [--data DIR] [--prompt S] [--tokens N] [--temp T] [--seed S]\n"
+                            "          [--kv f32|f16|int8] [--no-grammar] [--draft] [--draft-layers N]\n"
+                            "          [--workers 1|2] [--w8a8] [--mmap] [--plan] [--prefix FILE] [--songs]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (plan) return runPlan(kvType);
+
+    GPTModel model = {};
+    bool loaded = mapped ? gpt_load_partition(&model, "model")
+                         : gpt_load(&model, "/model.bin");
+    if (!loaded) return 1;
+    GPTSession session = {};
+    if (!gpt_session_init(&session, &model, kvType)) {
+        gpt_free(&model);
+        return 1;
+    }
+    if (seed) gpt_seed(&session, seed);
+    session.grammar = grammar;
+    session.speculative = speculative;
+    session.draft_layers = draftLayers;
+    session.w8a8 = w8a8;
+    if (prefixFile) gpt_prefix_load(&session, prefixFile);
+    if (speculative == GPT_SPEC_NGRAM) buildDraftIndex(&model);
+    if (workers > 1) gpt_parallel_start(1);
+
+    signal(SIGINT, onSigint);
+    fputs(prompt, stdout);
+    char* mml = gpt_generate(&session, prompt, maxTokens, temperature, printToken, nullptr,
+                             &cancelRequested);
+    fputs("\n", stdout);
+    gpt_parallel_stop();
+    if (prefixFile && session.prefix.dirty) gpt_prefix_save(&session, prefixFile);
+    gpt_session_free(&session);
+    if (!mml) {
+        gpt_free(&model);
+        return 1;
+    }
+
+    bool ok = strncmp(mml, "MML@", 4) == 0;
+    if (ok) {
+        printf("parsed (%d tracks):\n", countMMLTracks(mml));
+        ok = checkSong(mml, FMT_MML, "generated", true);
+    } else {
+        printf("generated output missing MML@ prefix\n");
+    }
+
+    free(mml);
+    gpt_free(&model);
+    return ok ? 0 : 1;
+}
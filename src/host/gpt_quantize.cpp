@@ -0,0 +1,186 @@
+// Converts an INT8 model.bin (MGPT quant_type 1) to the INT4 format
+// (quant_type 2): every weight matrix becomes packed nibbles with an fp16
+// scale per group of columns; embeddings, norms and the token map are
+// copied unchanged. The INT8 weights are the only source available here,
+// so groups are re-quantized from their dequantized values. Each group's
+// scale is picked from a small sweep around max|w| / 7 to minimize squared
+// error. Prints the relative RMS error per matrix kind.
+//
+//   gpt_quantize [--in FILE] [--out FILE] [--group N]
+
+#include <Arduino.h>
+#include "gpt_kernels.h"
+#include "gpt_simd.h"
+#include <cmath>
+#include <vector>
+
+struct Reader {
+    std::vector<uint8_t> data;
+    size_t at = 0;
+    const uint8_t* take(size_t n) {
+        if (at + n > data.size()) {
+            fprintf(stderr, "input truncated at offset %zu\n", at);
+            exit(1);
+        }
+        const uint8_t* p = data.data() + at;
+        at += n;
+        return p;
+    }
+};
+
+struct ErrorStats {
+    const char* name;
+    double err, ref;
+};
+
+static std::vector<uint8_t> outBuf;
+
+static void put(const void* p, size_t n) {
+    outBuf.insert(outBuf.end(), (const uint8_t*)p, (const uint8_t*)p + n);
+}
+
+// Best fp16 scale for one group and its nibbles
+static uint16_t quantizeGroup(const float* v, int n, int8_t* q) {
+    float amax = 0.0f;
+    for (int i = 0; i < n; i++) amax = std::max(amax, fabsf(v[i]));
+    uint16_t best = 0;
+    double bestErr = INFINITY;
+    for (int step = 0; step <= 12; step++) {
+        float scale = amax / 7.0f * (0.76f + 0.02f * step);
+        uint16_t h = fp32_to_fp16(scale);
+        float s = fp16_to_fp32(h);
+        double err = 0.0;
+        for (int i = 0; i < n; i++) {
+            long r = s > 0.0f ? lrintf(v[i] / s) : 0;
+            r = std::min(7L, std::max(-8L, r));
+            double d = v[i] - r * s;
+            err += d * d;
+        }
+        if (err < bestErr) {
+            bestErr = err;
+            best = h;
+        }
+    }
+    float s = fp16_to_fp32(best);
+    for (int i = 0; i < n; i++) {
+        long r = s > 0.0f ? lrintf(v[i] / s) : 0;
+        q[i] = (int8_t)std::min(7L, std::max(-8L, r));
+    }
+    return best;
+}
+
+static void convertMatrix(Reader& in, int rows, int cols, int group, ErrorStats& stats) {
+    const int8_t* w = (const int8_t*)in.take((size_t)rows * cols);
+    const float* s8 = (const float*)in.take((size_t)rows * sizeof(float));
+    int groups = cols / group;
+    std::vector<uint8_t> packed((size_t)rows * cols / 2);
+    std::vector<uint16_t> scales((size_t)rows * groups);
+    std::vector<float> v(group);
+    std::vector<int8_t> q(group);
+    for (int r = 0; r < rows; r++) {
+        for (int g = 0; g < groups; g++) {
+            const int8_t* src = w + (size_t)r * cols + g * group;
+            for (int i = 0; i < group; i++) v[i] = src[i] * s8[r];
+            uint16_t h = quantizeGroup(v.data(), group, q.data());
+            scales[(size_t)r * groups + g] = h;
+            float s = fp16_to_fp32(h);
+            for (int i = 0; i < group; i++) {
+                double d = v[i] - q[i] * s;
+                stats.err += d * d;
+                stats.ref += (double)v[i] * v[i];
+            }
+            uint8_t* dst = packed.data() + ((size_t)r * cols + g * group) / 2;
+            for (int i = 0; i < group; i += 2) {
+                dst[i / 2] = (uint8_t)((q[i] & 0x0F) | (q[i + 1] << 4));
+            }
+        }
+    }
+    put(packed.data(), packed.size());
+    put(scales.data(), scales.size() * sizeof(uint16_t));
+}
+
+static void copyFloats(Reader& in, size_t n) {
+    put(in.take(n * sizeof(float)), n * sizeof(float));
+}
+
+int main(int argc, char** argv) {
+    const char* inPath = "data/model.bin";
+    const char* outPath = "model_q4.bin";
+    int group = 32;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--in") && i + 1 < argc) inPath = argv[++i];
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc) outPath = argv[++i];
+        else if (!strcmp(argv[i], "--group") && i + 1 < argc) group = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [--in FILE] [--out FILE] [--group N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Reader in;
+    FILE* fp = fopen(inPath, "rb");
+    if (!fp) { perror(inPath); return 1; }
+    uint8_t chunk[65536];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), fp)) > 0) in.data.insert(in.data.end(), chunk, chunk + got);
+    fclose(fp);
+
+    // Header: magic, version, quant_type, config, 14 reserved bytes
+    const uint8_t* h = in.take(32);
+    if (memcmp(h, "MGPT", 4) != 0 || h[4] != 1 || h[5] != 1) {
+        fprintf(stderr, "%s: not an MGPT v1 INT8 model\n", inPath);
+        return 1;
+    }
+    int n_embd = h[6] | (h[7] << 8);
+    int n_layer = h[8];
+    int block_size = h[10] | (h[11] << 8);
+    int vocab_size = h[12] | (h[13] << 8);
+    if (group < 16 || group % 16 || group > GPT_Q4_GROUP_MAX || n_embd % group) {
+        fprintf(stderr, "group must be a multiple of 16, at most %d and divide n_embd (%d)\n", GPT_Q4_GROUP_MAX, n_embd);
+        return 1;
+    }
+    uint8_t header[32];
+    memcpy(header, h, sizeof(header));
+    header[5] = 2;
+    header[16] = (uint8_t)group;
+    put(header, sizeof(header));
+
+    // Token map and padding to 4 bytes, verbatim
+    size_t mapStart = in.at;
+    for (int i = 0; i < vocab_size; i++) {
+        uint8_t len = *in.take(1);
+        in.take(len);
+    }
+    in.at = (in.at + 3) & ~(size_t)3;
+    put(in.data.data() + mapStart, in.at - mapStart);
+
+    copyFloats(in, (size_t)vocab_size * n_embd);   // tok_emb
+    copyFloats(in, (size_t)block_size * n_embd);   // pos_emb
+
+    ErrorStats attn = { "attention", 0, 0 }, mlp = { "mlp", 0, 0 }, head = { "lm_head", 0, 0 };
+    for (int l = 0; l < n_layer; l++) {
+        copyFloats(in, n_embd);  // norm1_gamma
+        for (int m = 0; m < 4; m++) convertMatrix(in, n_embd, n_embd, group, attn);
+        copyFloats(in, n_embd);  // norm2_gamma
+        convertMatrix(in, 4 * n_embd, n_embd, group, mlp);
+        convertMatrix(in, n_embd, 4 * n_embd, group, mlp);
+    }
+    copyFloats(in, n_embd);      // final_norm_gamma
+    convertMatrix(in, vocab_size, n_embd, group, head);
+    if (in.at != in.data.size()) {
+        fprintf(stderr, "warning: %zu trailing bytes dropped\n", in.data.size() - in.at);
+    }
+
+    fp = fopen(outPath, "wb");
+    if (!fp || fwrite(outBuf.data(), 1, outBuf.size(), fp) != outBuf.size()) {
+        perror(outPath);
+        return 1;
+    }
+    fclose(fp);
+
+    printf("%s: %zu -> %zu bytes (group %d)\n", outPath, in.data.size(), outBuf.size(), group);
+    for (const ErrorStats* e : { &attn, &mlp, &head }) {
+        printf("  %-9s relative RMS error %.4f\n", e->name, e->ref > 0 ? sqrt(e->err / e->ref) : 0.0);
+    }
+    return 0;
+}
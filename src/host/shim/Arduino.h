@@ -0,0 +1,69 @@
+#pragma once
+// Minimal Arduino-ESP32 surface for the host (native) build.
+// Only what mini_gpt.cpp, music.cpp, player.cpp and songs.h actually use.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+
+#define PROGMEM
+#define IRAM_ATTR
+#define strlen_P   strlen
+#define strncpy_P  strncpy
+#define memcpy_P   memcpy
+
+// ---------- time ----------
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+// Host-only: switch millis() to a manually advanced clock (for driving
+// MelodyPlayer deterministically) or back to the wall clock.
+void hostSetClock(unsigned long ms);
+void hostUseWallClock();
+
+// ---------- FreeRTOS ----------
+typedef uint32_t TickType_t;
+void vTaskDelay(TickType_t ticks);
+
+// ---------- Serial ----------
+class HardwareSerial {
+public:
+    void begin(unsigned long) {}
+    size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const char* s);
+    size_t print(char c);
+    size_t println(const char* s = "");
+
+    // Host-only: silence engine logging (benchmarks)
+    void setQuiet(bool q) { quiet_ = q; }
+
+private:
+    bool quiet_ = false;
+};
+extern HardwareSerial Serial;
+
+// ---------- String ----------
+class String {
+public:
+    String(const char* s = "") : s_(s ? s : "") {}
+    String& operator+=(const char* s) { s_ += s; return *this; }
+    String& operator+=(char c) { s_ += c; return *this; }
+    unsigned int length() const { return (unsigned int)s_.size(); }
+    const char* c_str() const { return s_.c_str(); }
+
+private:
+    std::string s_;
+};
+
+// ---------- ESP ----------
+class EspClass {
+public:
+    uint32_t getFreeHeap();
+    uint32_t getFreePsram();
+};
+extern EspClass ESP;
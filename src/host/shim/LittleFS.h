@@ -0,0 +1,38 @@
+#pragma once
+// Host LittleFS: paths map onto a directory on disk (default "data", the
+// same directory PlatformIO uploads as the LittleFS image).
+
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class File {
+public:
+    File() = default;
+    explicit File(FILE* fp) : fp_(fp) {}
+    explicit operator bool() const { return fp_ != nullptr; }
+    size_t size();
+    size_t read(uint8_t* buf, size_t len);
+    size_t write(const uint8_t* buf, size_t len);
+    void close();
+
+private:
+    FILE* fp_ = nullptr;
+};
+
+class LittleFSFS {
+public:
+    bool begin(bool formatOnFail = false);
+    File open(const char* path, const char* mode = "r");
+    bool exists(const char* path);
+    bool remove(const char* path);
+
+    // Host-only: directory that "/" maps to
+    void setRoot(const char* dir) { root_ = dir; }
+    std::string hostPath(const char* path) const;
+
+private:
+    std::string root_ = "data";
+};
+extern LittleFSFS LittleFS;
@@ -0,0 +1,21 @@
+#pragma once
+// Host heap_caps: plain malloc with per-capability accounting so host
+// benchmarks can report current/peak SRAM and PSRAM like the device would.
+
+#include <cstddef>
+#include <cstdint>
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+void* heap_caps_malloc(size_t size, uint32_t caps);
+// Payloads are 16-byte aligned; larger alignments are not supported
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps);
+void heap_caps_free(void* ptr);
+size_t heap_caps_get_free_size(uint32_t caps);
+
+// Host-only accounting (bytes currently held / high-water mark)
+size_t host_heap_used(uint32_t caps);
+size_t host_heap_peak(uint32_t caps);
+void host_heap_reset_peak();
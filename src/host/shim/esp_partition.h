@@ -0,0 +1,44 @@
+#pragma once
+// Host esp_partition: the data partition labelled L is the file L.bin in
+// the LittleFS root directory, mapped read-only with mmap, so code that
+// runs from a flash mapping on the device runs from a file mapping here.
+
+#include <cstddef>
+#include <cstdint>
+
+typedef int esp_err_t;
+#define ESP_OK   0
+#define ESP_FAIL -1
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP  = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef enum {
+    SPI_FLASH_MMAP_DATA,
+    SPI_FLASH_MMAP_INST,
+} spi_flash_mmap_memory_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+
+struct esp_partition_t {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;    // host: size of the backing file
+    char label[17];
+    bool encrypted;
+};
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char* label);
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory, const void** out_ptr,
+                             spi_flash_mmap_handle_t* out_handle);
+void spi_flash_munmap(spi_flash_mmap_handle_t handle);
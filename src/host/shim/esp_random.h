@@ -0,0 +1,4 @@
+#pragma once
+#include <cstdint>
+
+uint32_t esp_random();
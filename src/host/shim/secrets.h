@@ -0,0 +1,4 @@
+#pragma once
+// Placeholder credentials so config.h resolves on the host build.
+#define WIFI_SSID ""
+#define WIFI_PASS ""
@@ -0,0 +1,259 @@
+#include "Arduino.h"
+#include "LittleFS.h"
+#include "esp_heap_caps.h"
+#include "esp_partition.h"
+#include "esp_random.h"
+#include <chrono>
+#include <cstdarg>
+#include <fcntl.h>
+#include <map>
+#include <random>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// ---------- time ----------
+static const auto bootTime = std::chrono::steady_clock::now();
+static bool manualClock = false;
+static unsigned long manualMs = 0;
+
+unsigned long millis() {
+    if (manualClock) return manualMs;
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long micros() {
+    if (manualClock) return manualMs * 1000UL;
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+void delay(unsigned long ms) {
+    if (manualClock) { manualMs += ms; return; }
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void hostSetClock(unsigned long ms) {
+    manualClock = true;
+    manualMs = ms;
+}
+
+void hostUseWallClock() {
+    manualClock = false;
+}
+
+void vTaskDelay(TickType_t) {
+    std::this_thread::yield();
+}
+
+// ---------- Serial ----------
+HardwareSerial Serial;
+
+size_t HardwareSerial::printf(const char* fmt, ...) {
+    if (quiet_) return 0;
+    va_list args;
+    va_start(args, fmt);
+    int n = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return n > 0 ? (size_t)n : 0;
+}
+
+size_t HardwareSerial::print(const char* s) {
+    if (quiet_) return 0;
+    return fputs(s, stderr) >= 0 ? strlen(s) : 0;
+}
+
+size_t HardwareSerial::print(char c) {
+    if (quiet_) return 0;
+    return fputc(c, stderr) != EOF ? 1 : 0;
+}
+
+size_t HardwareSerial::println(const char* s) {
+    if (quiet_) return 0;
+    return print(s) + print('\n');
+}
+
+// ---------- heap_caps ----------
+// Simulated ESP32-S3 budgets (internal heap after WiFi/stack, 8MB OPI PSRAM)
+static const size_t HOST_SRAM_BYTES  = 320 * 1024;
+static const size_t HOST_PSRAM_BYTES = 8 * 1024 * 1024;
+
+struct AllocHeader {
+    size_t size;
+    uint32_t caps;
+    uint32_t pad[3];  // keep payload 16-byte aligned
+};
+
+static size_t usedSram = 0, peakSram = 0;
+static size_t usedPsram = 0, peakPsram = 0;
+
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+    bool psram = (caps & MALLOC_CAP_SPIRAM) != 0;
+    size_t& used = psram ? usedPsram : usedSram;
+    size_t& peak = psram ? peakPsram : peakSram;
+    size_t budget = psram ? HOST_PSRAM_BYTES : HOST_SRAM_BYTES;
+    if (used + size > budget) return nullptr;
+
+    AllocHeader* h = (AllocHeader*)malloc(sizeof(AllocHeader) + size);
+    if (!h) return nullptr;
+    h->size = size;
+    h->caps = caps;
+    used += size;
+    if (used > peak) peak = used;
+    return h + 1;
+}
+
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+    if (alignment > sizeof(AllocHeader)) return nullptr;
+    return heap_caps_malloc(size, caps);
+}
+
+void heap_caps_free(void* ptr) {
+    if (!ptr) return;
+    AllocHeader* h = (AllocHeader*)ptr - 1;
+    if (h->caps & MALLOC_CAP_SPIRAM) usedPsram -= h->size;
+    else usedSram -= h->size;
+    free(h);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    if (caps & MALLOC_CAP_SPIRAM) return HOST_PSRAM_BYTES - usedPsram;
+    return HOST_SRAM_BYTES - usedSram;
+}
+
+size_t host_heap_used(uint32_t caps) {
+    return (caps & MALLOC_CAP_SPIRAM) ? usedPsram : usedSram;
+}
+
+size_t host_heap_peak(uint32_t caps) {
+    return (caps & MALLOC_CAP_SPIRAM) ? peakPsram : peakSram;
+}
+
+void host_heap_reset_peak() {
+    peakSram = usedSram;
+    peakPsram = usedPsram;
+}
+
+// ---------- esp_partition ----------
+// Found partitions stay valid for the process lifetime, as on the device
+static std::map<std::string, esp_partition_t> partitions;
+struct HostMapping {
+    void* addr;
+    size_t len;
+};
+static std::map<spi_flash_mmap_handle_t, HostMapping> mappings;
+static spi_flash_mmap_handle_t nextMapping = 1;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char* label) {
+    if (type != ESP_PARTITION_TYPE_DATA || !label) return nullptr;
+    struct stat st;
+    std::string path = LittleFS.hostPath((std::string("/") + label + ".bin").c_str());
+    if (stat(path.c_str(), &st) != 0) return nullptr;
+
+    esp_partition_t& p = partitions[path];
+    p.type = type;
+    p.subtype = subtype;
+    p.address = 0;
+    p.size = (uint32_t)st.st_size;
+    snprintf(p.label, sizeof(p.label), "%s", label);
+    p.encrypted = false;
+    return &p;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t, const void** out_ptr,
+                             spi_flash_mmap_handle_t* out_handle) {
+    if (offset + size > partition->size) return ESP_FAIL;
+    std::string path = LittleFS.hostPath((std::string("/") + partition->label + ".bin").c_str());
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return ESP_FAIL;
+    void* addr = mmap(nullptr, offset + size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return ESP_FAIL;
+    mappings[nextMapping] = { addr, offset + size };
+    *out_handle = nextMapping++;
+    *out_ptr = (const uint8_t*)addr + offset;
+    return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle) {
+    auto it = mappings.find(handle);
+    if (it == mappings.end()) return;
+    munmap(it->second.addr, it->second.len);
+    mappings.erase(it);
+}
+
+// ---------- ESP ----------
+EspClass ESP;
+
+uint32_t EspClass::getFreeHeap() {
+    return (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+}
+
+uint32_t EspClass::getFreePsram() {
+    return (uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+}
+
+// ---------- esp_random ----------
+static std::mt19937 hostRng{std::random_device{}()};
+
+uint32_t esp_random() {
+    return hostRng();
+}
+
+// ---------- LittleFS ----------
+LittleFSFS LittleFS;
+
+size_t File::size() {
+    if (!fp_) return 0;
+    long cur = ftell(fp_);
+    fseek(fp_, 0, SEEK_END);
+    long end = ftell(fp_);
+    fseek(fp_, cur, SEEK_SET);
+    return end > 0 ? (size_t)end : 0;
+}
+
+size_t File::read(uint8_t* buf, size_t len) {
+    return fp_ ? fread(buf, 1, len, fp_) : 0;
+}
+
+size_t File::write(const uint8_t* buf, size_t len) {
+    return fp_ ? fwrite(buf, 1, len, fp_) : 0;
+}
+
+void File::close() {
+    if (fp_) fclose(fp_);
+    fp_ = nullptr;
+}
+
+bool LittleFSFS::begin(bool) {
+    return true;
+}
+
+std::string LittleFSFS::hostPath(const char* path) const {
+    std::string p = root_;
+    if (path[0] != '/') p += '/';
+    p += path;
+    return p;
+}
+
+File LittleFSFS::open(const char* path, const char* mode) {
+    std::string m = mode;
+    if (m.find('b') == std::string::npos) m += 'b';
+    return File(fopen(hostPath(path).c_str(), m.c_str()));
+}
+
+bool LittleFSFS::exists(const char* path) {
+    FILE* fp = fopen(hostPath(path).c_str(), "rb");
+    if (!fp) return false;
+    fclose(fp);
+    return true;
+}
+
+bool LittleFSFS::remove(const char* path) {
+    return ::remove(hostPath(path).c_str()) == 0;
+}
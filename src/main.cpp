@@ -2,32 +2,52 @@
 #include <WiFi.h>
 #include <ESPAsyncWebServer.h>
 #include <LittleFS.h>
+#include <esp_random.h>
 #include "config.h"
 #include "songs.h"
 #include "mini_gpt.h"
+#include "gpt_simd.h"
+#include "music.h"
+#include "player.h"
 
 // ---------- state ----------
 enum State { IDLE, PLAYING };
 volatile State state = IDLE;
 volatile unsigned long stateEnteredAt = 0;
 unsigned long lastWifiCheck = 0;
-uint8_t volumePercent = DEFAULT_VOLUME;
 
 // ---------- GPT generation ----------
-MiniGPT gptModel;
-bool gptLoaded = false;
-volatile bool generating = false;
-volatile bool genAbort = false;
+GPTModel gptModel;
+GPTSession gptSessions[GPT_SESSIONS];  // One per generation worker
+volatile bool gptLoaded = false;  // Set by gptLoadTask once the model is ready
 float genTemperature = 0.8f;
-QueueHandle_t genResultQueue;
+
+// A client's generation request, waiting or running. It holds its slot
+// from "gen" until a worker has finished with it.
+struct GenRequest {
+    uint32_t client;        // WebSocket client id (0 = free slot)
+    uint32_t seed;          // 0 = random
+    float temperature;
+    volatile bool cancel;   // gen:stop or disconnect
+};
+GenRequest genRequests[GPT_GEN_QUEUE];
+portMUX_TYPE genLock = portMUX_INITIALIZER_UNLOCKED;  // Guards slot ownership
+QueueHandle_t genRequestQueue;  // GenRequest*, in arrival order
+QueueHandle_t genResultQueue;  // char* MML for playback, drained by loop()
+static const TickType_t genResultWait = pdMS_TO_TICKS(1000);  // Worker wait for room in it
 QueueHandle_t wsMessageQueue;  // For thread-safe WS messaging from core 0
 
+struct WsMessage {
+    uint32_t client;  // 0 = every client
+    char* text;
+};
+
 // Send a WebSocket message from any core (queued, drained in loop on core 1)
-static void queueWsMessage(const char* msg) {
-    char* copy = strdup(msg);
-    if (copy) {
-        if (xQueueSend(wsMessageQueue, &copy, 0) != pdTRUE) {
-            free(copy);  // Queue full, drop message
+static void queueWsMessage(const char* msg, uint32_t client = 0) {
+    WsMessage m = { client, strdup(msg) };
+    if (m.text) {
+        if (xQueueSend(wsMessageQueue, &m, 0) != pdTRUE) {
+            free(m.text);  // Queue full, drop message
         }
     }
 }
@@ -37,15 +57,8 @@ void playGeneratedMML(char* mml);
 void enterState(State s);
 
 // ---------- Software PWM via timer ISR (replaces LEDC to avoid first-cycle glitch) ----------
-#define SAMPLE_RATE_HZ 40000
 #define TIMER_DIVIDER  2      // 80MHz / 2 = 40MHz, then alarm at 1000 ticks = 40kHz
 
-struct BuzzerPWM {
-    volatile uint32_t phase;      // 32-bit phase accumulator
-    volatile uint32_t phaseInc;   // Phase increment (determines frequency)
-    volatile uint16_t dutyOn;     // PWM duty threshold (0-512)
-};
-volatile BuzzerPWM buzzerPWM[NUM_BUZZERS] = {};
 hw_timer_t* audioTimer = nullptr;
 
 // Pin masks for direct GPIO manipulation (GPIO 4,5,6,7 are on GPIO.out, GPIO 15 is also on GPIO.out)
@@ -81,210 +94,6 @@ void IRAM_ATTR audioISR() {
     if (clearMask) GPIO.out_w1tc = clearMask;
 }
 
-// ---------- note frequency helper ----------
-static const uint16_t NOTE_FREQS[12] = { 262,277,294,311,330,349,370,392,415,440,466,494 }; // C4..B4
-
-uint16_t noteFreq(uint8_t semitone, uint8_t octave) {
-    uint16_t f = NOTE_FREQS[semitone % 12];
-    if (octave > 4) f <<= (octave - 4);
-    else if (octave < 4) f >>= (4 - octave);
-    return f;
-}
-
-static uint8_t letterToSemitone(char c) {
-    switch (c) {
-        case 'c': return 0;  case 'd': return 2;  case 'e': return 4;
-        case 'f': return 5;  case 'g': return 7;  case 'a': return 9;
-        case 'b': return 11; default:  return 0;
-    }
-}
-
-// ---------- RTTTL parser ----------
-uint16_t parseRTTTL(const char* rtttl, uint16_t out[][2], uint16_t maxNotes) {
-    const char* p = rtttl;
-    while (*p && *p != ':') p++;
-    if (!*p) return 0;
-    p++;
-
-    uint8_t defDur = 4, defOct = 6;
-    uint16_t bpm = 63;
-    while (*p && *p != ':') {
-        while (*p == ' ' || *p == ',') p++;
-        if (*p == 'd' && *(p+1) == '=') { p += 2; defDur = atoi(p); while (*p >= '0' && *p <= '9') p++; }
-        else if (*p == 'o' && *(p+1) == '=') { p += 2; defOct = atoi(p); while (*p >= '0' && *p <= '9') p++; }
-        else if (*p == 'b' && *(p+1) == '=') { p += 2; bpm = atoi(p); while (*p >= '0' && *p <= '9') p++; }
-        else p++;
-    }
-    if (!*p) return 0;
-    p++;
-
-    if (bpm == 0) bpm = 63;
-    uint16_t count = 0;
-
-    while (*p && count < maxNotes) {
-        while (*p == ' ' || *p == ',') p++;
-        if (!*p) break;
-
-        uint8_t dur = 0;
-        while (*p >= '0' && *p <= '9') { dur = dur * 10 + (*p - '0'); p++; }
-        if (dur == 0) dur = defDur;
-
-        uint16_t freq = 0;
-        if (*p == 'p' || *p == 'P') {
-            p++;
-        } else if ((*p >= 'a' && *p <= 'g') || (*p >= 'A' && *p <= 'G')) {
-            char note = *p | 0x20;
-            p++;
-            uint8_t semi = letterToSemitone(note);
-            if (*p == '#') { semi++; p++; }
-            else if (*p == '_') { semi++; p++; }
-            uint8_t oct = defOct;
-            if (*p >= '0' && *p <= '9') { oct = *p - '0'; p++; }
-            freq = noteFreq(semi, oct);
-        } else {
-            p++; continue;
-        }
-
-        uint32_t divisor = (uint32_t)bpm * dur;
-        uint16_t ms = (uint16_t)((240000UL + divisor / 2) / divisor);
-        if (*p == '.') { ms = (ms * 3 + 1) / 2; p++; }
-
-        out[count][0] = freq;
-        out[count][1] = ms;
-        count++;
-    }
-    return count;
-}
-
-// ---------- MML parser ----------
-uint16_t parseMML(const char* mml, uint16_t out[][2], uint16_t maxNotes, uint8_t track = 0) {
-    const char* p = mml;
-
-    if (p[0]=='M'&&p[1]=='M'&&p[2]=='L'&&p[3]=='@') p += 4;
-
-    const char* end = p;
-    while (*end && *end != ';') end++;
-
-    // Scan Track 0 preamble for initial tempo (applies to all tracks)
-    uint16_t initTempo = 120;
-    {
-        const char* s = p;
-        const char* t0end = s;
-        while (t0end < end && *t0end != ',') t0end++;
-        while (s < t0end) {
-            char c = *s;
-            if ((c >= 'a' && c <= 'g') || (c >= 'A' && c <= 'G') || c == 'r' || c == 'R')
-                break; // stop at first note/rest
-            if (c == 't' || c == 'T') {
-                s++;
-                uint16_t val = 0;
-                while (s < t0end && *s >= '0' && *s <= '9') { val = val*10 + (*s-'0'); s++; }
-                if (val > 0) initTempo = val;
-            } else {
-                s++;
-            }
-        }
-    }
-
-    uint8_t currentTrack = 0;
-    while (currentTrack < track && p < end) {
-        if (*p == ',') { currentTrack++; if (currentTrack == track) { p++; break; } }
-        p++;
-    }
-    if (currentTrack != track) return 0;
-
-    const char* trackEnd = p;
-    while (trackEnd < end && *trackEnd != ',') trackEnd++;
-
-    uint8_t octave = 4;
-    uint8_t defaultLength = 4;
-    uint16_t tempo = initTempo;
-    uint16_t count = 0;
-
-    while (p < trackEnd && count < maxNotes) {
-        char c = *p;
-
-        if (c == 't' || c == 'T') {
-            p++;
-            uint16_t val = 0;
-            while (p < trackEnd && *p >= '0' && *p <= '9') { val = val*10 + (*p-'0'); p++; }
-            if (val > 0) tempo = val;
-            continue;
-        }
-        if (c == 'l' || c == 'L') {
-            p++;
-            uint8_t val = 0;
-            while (p < trackEnd && *p >= '0' && *p <= '9') { val = val*10 + (*p-'0'); p++; }
-            if (val > 0) defaultLength = val;
-            continue;
-        }
-        if (c == 'o' || c == 'O') {
-            p++;
-            uint8_t val = 0;
-            while (p < trackEnd && *p >= '0' && *p <= '9') { val = val*10 + (*p-'0'); p++; }
-            octave = val;
-            continue;
-        }
-        if (c == '>') { octave++; p++; continue; }
-        if (c == '<') { octave--; p++; continue; }
-        if (c == 'v' || c == 'V') {
-            p++;
-            while (p < trackEnd && *p >= '0' && *p <= '9') p++;
-            continue;
-        }
-
-        bool isNote = (c >= 'a' && c <= 'g') || (c >= 'A' && c <= 'G');
-        bool isRest = (c == 'r' || c == 'R');
-
-        if (!isNote && !isRest) { p++; continue; }
-
-        uint16_t freq = 0;
-        if (isNote) {
-            char noteLower = c | 0x20;
-            p++;
-            uint8_t semi = letterToSemitone(noteLower);
-            if (p < trackEnd && (*p == '+' || *p == '#')) { semi++; p++; }
-            else if (p < trackEnd && *p == '-') { semi--; p++; }
-            freq = noteFreq(semi, octave);
-        } else {
-            p++;
-        }
-
-        uint8_t noteLen = 0;
-        while (p < trackEnd && *p >= '0' && *p <= '9') { noteLen = noteLen*10 + (*p-'0'); p++; }
-        if (noteLen == 0) noteLen = defaultLength;
-
-        // Single rounded division to avoid double-truncation drift between tracks
-        uint32_t divisor = (uint32_t)tempo * noteLen;
-        uint32_t ms = (240000UL + divisor / 2) / divisor;
-
-        if (p < trackEnd && *p == '.') { ms = (ms * 3 + 1) / 2; p++; }
-
-        while (p < trackEnd && *p == '&') {
-            p++;
-            if (p < trackEnd && ((*p >= 'a' && *p <= 'g') || (*p >= 'A' && *p <= 'G'))) {
-                p++;
-                if (p < trackEnd && (*p == '+' || *p == '#' || *p == '-')) p++;
-            } else if (p < trackEnd && (*p == 'r' || *p == 'R')) {
-                p++;
-            }
-            uint8_t tieLen = 0;
-            while (p < trackEnd && *p >= '0' && *p <= '9') { tieLen = tieLen*10 + (*p-'0'); p++; }
-            if (tieLen == 0) tieLen = defaultLength;
-            uint32_t tieDivisor = (uint32_t)tempo * tieLen;
-            uint32_t tieMs = (240000UL + tieDivisor / 2) / tieDivisor;
-            if (p < trackEnd && *p == '.') { tieMs = (tieMs * 3 + 1) / 2; p++; }
-            ms += tieMs;
-        }
-
-        if (ms > 65535) ms = 65535;
-        out[count][0] = freq;
-        out[count][1] = (uint16_t)ms;
-        count++;
-    }
-    return count;
-}
-
 // ---------- multi-track song data model ----------
 struct TrackData {
     uint16_t (*notes)[2];
@@ -304,21 +113,6 @@ struct SongEntry {
 static SongEntry songs[MAX_SONGS];
 static uint16_t SONG_COUNT = 0;
 
-uint8_t countMMLTracks(const char* mml) {
-    const char* p = mml;
-    if (p[0]=='M'&&p[1]=='M'&&p[2]=='L'&&p[3]=='@') p += 4;
-
-    const char* end = p;
-    while (*end && *end != ';') end++;
-
-    uint8_t count = 1;
-    while (p < end) {
-        if (*p == ',') count++;
-        p++;
-    }
-    return count;
-}
-
 void freeSongTracks(SongEntry& song) {
     if (!song.parsed) return;
     for (uint8_t t = 0; t < MAX_TRACKS; t++) {
@@ -440,82 +234,9 @@ void parseSongDefs() {
 // ---------- multi-track melody player ----------
 static const uint8_t buzzerPins[NUM_BUZZERS] = { PIN_BUZ0, PIN_BUZ1, PIN_BUZ2, PIN_BUZ3, PIN_BUZ4 };
 
-struct MelodyPlayer {
-    const uint16_t (*melody)[2];
-    uint16_t length;
-    uint16_t noteIndex;
-    unsigned long noteStartedAt;
-    uint16_t gapDuration;
-    bool playing;
-    bool inGap;
-    bool inLoopPause;
-    uint8_t buzzerPin;
-    uint8_t ledcChannel;
-    int8_t octaveShift;
-};
-
 MelodyPlayer players[NUM_BUZZERS];
 int16_t currentSongIndex = -1;
 
-// Set up buzzer output for current note (does NOT touch timing)
-void setupNote(MelodyPlayer& p) {
-    uint16_t freq = p.melody[p.noteIndex][0];
-    uint16_t duration = p.melody[p.noteIndex][1];
-    if (freq > 0) {
-        // Apply octave shift via bit shifting (each octave doubles/halves frequency)
-        if (p.octaveShift > 0) freq <<= p.octaveShift;
-        else if (p.octaveShift < 0) freq >>= -p.octaveShift;
-
-        // Clamp to usable range for passive buzzers
-        if (freq < 65) freq = 65;
-        if (freq > 4000) freq = 4000;
-
-        // Software PWM via timer ISR — phase-continuous, no first-cycle glitch
-        buzzerPWM[p.ledcChannel].phase = 0;  // Reset phase for clean note attack
-        buzzerPWM[p.ledcChannel].phaseInc = ((uint64_t)freq << 32) / SAMPLE_RATE_HZ;
-        buzzerPWM[p.ledcChannel].dutyOn = ((uint32_t)volumePercent * 512) / 100;
-        p.gapDuration = duration / 10;
-        if (p.gapDuration < 20) p.gapDuration = 20;
-        if (p.gapDuration >= duration) p.gapDuration = 0;
-    } else {
-        buzzerPWM[p.ledcChannel].phaseInc = 0;
-        p.gapDuration = 0;
-    }
-    p.inGap = false;
-}
-
-void advanceNote(MelodyPlayer& p) {
-    p.noteIndex++;
-    if (p.noteIndex >= p.length) {
-        Serial.printf("[TRACK] Buzzer %d finished (%d notes) at %lums\n",
-            p.ledcChannel, p.length, millis());
-        p.inLoopPause = true;
-        buzzerPWM[p.ledcChannel].dutyOn = 0;  // Silence via duty cycle
-        return;
-    }
-    setupNote(p);
-}
-
-void updatePlayer(MelodyPlayer& p) {
-    if (!p.playing || p.inLoopPause) return;
-    unsigned long elapsed = millis() - p.noteStartedAt;
-    uint16_t duration = p.melody[p.noteIndex][1];
-    uint16_t toneDuration = (p.gapDuration > 0)
-        ? (duration - p.gapDuration) : duration;
-
-    // Silence buzzer when tone portion ends (gap begins)
-    if (!p.inGap && p.gapDuration > 0 && elapsed >= toneDuration) {
-        buzzerPWM[p.ledcChannel].dutyOn = 0;  // Silence via duty cycle
-        p.inGap = true;
-    }
-
-    // Advance to next note when full duration ends (absolute timing)
-    if (elapsed >= duration) {
-        p.noteStartedAt += duration;
-        advanceNote(p);
-    }
-}
-
 // ---------- track distribution ----------
 void assignTracks(SongEntry& song) {
     uint8_t available = 0;
@@ -621,12 +342,55 @@ bool anyPlayerActive() {
 AsyncWebServer server(SERVER_PORT);
 AsyncWebSocket ws("/ws");
 
-// ---------- GPT streaming callback and generation task ----------
+// ---------- GPT streaming callback and generation workers ----------
 void streamCallback(const char* token, void* userData) {
-    if (genAbort) return;
+    GenRequest* req = (GenRequest*)userData;
+    if (req->cancel) return;
     char msg[64];
     snprintf(msg, sizeof(msg), "gen:t:%s", token);
-    queueWsMessage(msg);
+    queueWsMessage(msg, req->client);
+}
+
+// Take a free request slot for client, or nullptr if it already has a
+// request or none is free. *ahead counts the requests before it.
+static GenRequest* genSubmit(uint32_t client, uint32_t seed, float temperature, int* ahead) {
+    GenRequest* req = nullptr;
+    bool pending = false;
+    int used = 0;
+    portENTER_CRITICAL(&genLock);
+    for (GenRequest& r : genRequests) {
+        if (!r.client) {
+            if (!req) req = &r;
+            continue;
+        }
+        used++;
+        if (r.client == client) pending = true;
+    }
+    if (pending) req = nullptr;
+    if (req) {
+        req->client = client;
+        req->seed = seed;
+        req->temperature = temperature;
+        req->cancel = false;
+    }
+    portEXIT_CRITICAL(&genLock);
+    *ahead = used;
+    return req;
+}
+
+// Cancel the client's request, waiting or running
+static void genCancel(uint32_t client) {
+    portENTER_CRITICAL(&genLock);
+    for (GenRequest& r : genRequests) {
+        if (r.client == client) r.cancel = true;
+    }
+    portEXIT_CRITICAL(&genLock);
+}
+
+static void genRelease(GenRequest* req) {
+    portENTER_CRITICAL(&genLock);
+    req->client = 0;
+    portEXIT_CRITICAL(&genLock);
 }
 
 // Storage for generated song playback (persists until next gen or song play)
@@ -701,38 +465,406 @@ void playGeneratedMML(char* mml) {
     enterState(PLAYING);
 }
 
-void genTask(void* param) {
-    // PSRAM check
-    if (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) < 512 * 1024) {
-        queueWsMessage("gen:err:low memory");
-        generating = false;
-        vTaskDelete(NULL);
-        return;
+// Too little PSRAM left to start a generation
+static bool genLowMemory() {
+    return heap_caps_get_free_size(MALLOC_CAP_SPIRAM) < 512 * 1024;
+}
+
+// Seeds session for req and tells the client; false if memory is too low
+static bool startRequest(GPTSession* session, GenRequest* req) {
+    if (genLowMemory()) {
+        queueWsMessage("gen:err:low memory", req->client);
+        return false;
     }
 
-    queueWsMessage("gen:start");
-    char* mml = gpt_generate(&gptModel, "MML@", 900, genTemperature,
-                              streamCallback, nullptr);
+    // Seed per request so a run can be replayed with "gen:seed:<n>"
+    uint32_t seed = req->seed ? req->seed : esp_random();
+    gpt_seed(session, seed);
 
-    if (mml && !genAbort) {
+    queueWsMessage("gen:start", req->client);
+    {
+        char seedMsg[24];
+        snprintf(seedMsg, sizeof(seedMsg), "gen:seed:%u", seed);
+        queueWsMessage(seedMsg, req->client);
+    }
+    return true;
+}
+
+// Sends the result of req and queues it for playback; takes mml
+static void finishRequest(GPTSession* session, GenRequest* req, char* mml) {
+    if (mml && !req->cancel) {
         // Send full result
         size_t len = strlen(mml);
         char* msg = (char*)malloc(len + 16);
         if (msg) {
             snprintf(msg, len + 16, "gen:done:%s", mml);
-            queueWsMessage(msg);
+            queueWsMessage(msg, req->client);
             free(msg);
         }
-        // Queue for playback (transfer ownership of mml to main loop)
-        if (xQueueSend(genResultQueue, &mml, 0) != pdTRUE) {
-            free(mml);  // Queue full, free it
+        // Queue for playback (transfer ownership of mml to main loop),
+        // waiting for loop() to make room rather than dropping it
+        if (xQueueSend(genResultQueue, &mml, genResultWait) != pdTRUE) {
+            free(mml);
+            queueWsMessage("gen:err:playback busy", req->client);
         }
     } else {
         if (mml) free(mml);
-        queueWsMessage(genAbort ? "gen:err:aborted" : "gen:err:failed");
+        queueWsMessage(req->cancel ? "gen:err:aborted" : "gen:err:failed", req->client);
+    }
+#if GPT_PREFIX_PERSIST
+    // A new prompt was snapshotted; keep it for the next boot (the first
+    // session's snapshots only, so workers never write the file at once)
+    if (session == &gptSessions[0] && session->prefix.dirty) {
+        gpt_prefix_save(session, GPT_PREFIX_FILE);
+    }
+#endif
+}
+
+static void runRequest(GPTSession* session, GenRequest* req) {
+    if (!startRequest(session, req)) return;
+    char* mml = gpt_generate(session, "MML@", 900, req->temperature,
+                              streamCallback, req, &req->cancel);
+    finishRequest(session, req, mml);
+}
+
+#if GPT_POOL_SIZE
+// ---------- generate-ahead pool ----------
+struct PoolEntry {
+    char* mml;          // PSRAM, nullptr = empty slot
+    uint32_t seed;
+    float temperature;  // Sampled at; dropped once genTemperature changes
+    bool stored;        // Has a GPT_POOL_FILE copy (worker only)
+};
+PoolEntry genPool[GPT_POOL_SIZE];  // mml/seed/temperature guarded by genLock
+volatile bool poolCancel = false;  // Set by "gen": abandon the refill
+
+// True if parseMML gets notes out of every track
+static bool validateMML(const char* mml) {
+    if (strncmp(mml, "MML@", 4) != 0) return false;
+    uint8_t tc = countMMLTracks(mml);
+    if (tc == 0) return false;
+    uint16_t (*tempBuf)[2] = (uint16_t(*)[2])malloc(MAX_NOTES_PER_SONG * sizeof(uint16_t[2]));
+    if (!tempBuf) return false;
+    bool ok = true;
+    for (uint8_t t = 0; t < tc && t < MAX_TRACKS && ok; t++) {
+        ok = parseMML(mml, tempBuf, MAX_NOTES_PER_SONG, t) > 0;
+    }
+    free(tempBuf);
+    return ok;
+}
+
+// Take a melody sampled at the current temperature, if one is ready
+static bool poolTake(PoolEntry* out) {
+    bool found = false;
+    portENTER_CRITICAL(&genLock);
+    for (PoolEntry& e : genPool) {
+        if (e.mml && e.temperature == genTemperature) {
+            *out = e;
+            e.mml = nullptr;
+            found = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&genLock);
+    return found;
+}
+
+// No request waiting or running
+static bool genIdle() {
+    bool idle = true;
+    portENTER_CRITICAL(&genLock);
+    for (GenRequest& r : genRequests) {
+        if (r.client) idle = false;
+    }
+    portEXIT_CRITICAL(&genLock);
+    return idle;
+}
+
+// The client has a request waiting or running
+static bool genPending(uint32_t client) {
+    bool pending = false;
+    portENTER_CRITICAL(&genLock);
+    for (GenRequest& r : genRequests) {
+        if (r.client == client) pending = true;
     }
+    portEXIT_CRITICAL(&genLock);
+    return pending;
+}
+
+#if GPT_POOL_PERSIST
+// Slot file: seed (u32), temperature (f32), then the MML text
+static void poolStore(int slot, const char* mml, uint32_t seed, float temperature) {
+    char path[24];
+    snprintf(path, sizeof(path), GPT_POOL_FILE, slot);
+    File f = LittleFS.open(path, "w");
+    if (!f) return;
+    size_t len = strlen(mml);
+    bool ok = f.write((const uint8_t*)&seed, 4) == 4 && f.write((const uint8_t*)&temperature, 4) == 4 &&
+              f.write((const uint8_t*)mml, len) == len;
+    f.close();
+    if (ok) genPool[slot].stored = true;
+    else LittleFS.remove(path);
+}
+
+static void poolRemove(int slot) {
+    char path[24];
+    snprintf(path, sizeof(path), GPT_POOL_FILE, slot);
+    LittleFS.remove(path);
+    genPool[slot].stored = false;
+}
 
-    generating = false;
+// Refill the pool from the slot files at boot
+static void poolLoad() {
+    for (int i = 0; i < GPT_POOL_SIZE; i++) {
+        char path[24];
+        snprintf(path, sizeof(path), GPT_POOL_FILE, i);
+        File f = LittleFS.open(path, "r");
+        if (!f) continue;
+        size_t len = f.size() > 8 ? f.size() - 8 : 0;
+        uint32_t seed = 0;
+        float temperature = 0.0f;
+        char* mml = len ? (char*)heap_caps_malloc(len + 1, MALLOC_CAP_SPIRAM) : nullptr;
+        bool ok = mml && f.read((uint8_t*)&seed, 4) == 4 && f.read((uint8_t*)&temperature, 4) == 4 &&
+                  f.read((uint8_t*)mml, len) == len;
+        f.close();
+        if (ok) {
+            mml[len] = '\0';
+            ok = validateMML(mml);
+        }
+        if (!ok) {
+            free(mml);
+            LittleFS.remove(path);
+            continue;
+        }
+        genPool[i] = { mml, seed, temperature, true };
+        Serial.printf("[GPT] Pool: melody %d restored (seed %u)\n", i, seed);
+    }
+}
+#endif
+
+// Called by the worker when idle: clears stale slots, then generates one
+// melody into an empty slot. Any request arriving meanwhile cancels it.
+static void poolRefill(GPTSession* session) {
+    int slot = -1;
+    for (int i = 0; i < GPT_POOL_SIZE; i++) {
+        PoolEntry& e = genPool[i];
+        char* stale = nullptr;
+        portENTER_CRITICAL(&genLock);
+        if (e.mml && e.temperature != genTemperature) {
+            stale = e.mml;
+            e.mml = nullptr;
+        }
+        bool empty = !e.mml;
+        portEXIT_CRITICAL(&genLock);
+        free(stale);
+#if GPT_POOL_PERSIST
+        if (empty && e.stored) poolRemove(i);
+#endif
+        if (empty && slot < 0) slot = i;
+    }
+    if (slot < 0) return;
+
+    // Checked after clearing the flag, so a request that lands later
+    // still cancels this run
+    poolCancel = false;
+    if (!genIdle() || genLowMemory()) return;
+    uint32_t seed = esp_random();
+    float temperature = genTemperature;
+    gpt_seed(session, seed);
+    char* mml = gpt_generate(session, "MML@", 900, temperature, nullptr, nullptr, &poolCancel);
+    if (!mml || poolCancel || !validateMML(mml)) {
+        if (poolCancel) Serial.println("[GPT] Pool: refill dropped for a request");
+        else Serial.println("[GPT] Pool: melody failed to parse, discarded");
+        free(mml);
+        return;
+    }
+    size_t len = strlen(mml);
+    char* copy = (char*)heap_caps_malloc(len + 1, MALLOC_CAP_SPIRAM);
+    if (copy) memcpy(copy, mml, len + 1);
+    free(mml);
+    if (!copy) return;
+
+    portENTER_CRITICAL(&genLock);
+    genPool[slot].mml = copy;
+    genPool[slot].seed = seed;
+    genPool[slot].temperature = temperature;
+    portEXIT_CRITICAL(&genLock);
+    Serial.printf("[GPT] Pool: melody %d ready (seed %u, %u chars)\n", slot, seed, (unsigned)len);
+#if GPT_POOL_PERSIST
+    poolStore(slot, copy, seed, temperature);
+#endif
+}
+
+// Answer "gen" from the pool exactly as a finished request would
+static void poolServe(AsyncWebSocketClient* client, PoolEntry& e) {
+    // Queue for playback first (transfer ownership of mml to main loop);
+    // this handler must not block, and the queue has room for every entry
+    char* mml = e.mml;
+    if (xQueueSend(genResultQueue, &mml, 0) != pdTRUE) {
+        free(mml);
+        client->text("gen:err:playback busy");
+        return;
+    }
+    client->text("gen:start");
+    char seedMsg[24];
+    snprintf(seedMsg, sizeof(seedMsg), "gen:seed:%u", e.seed);
+    client->text(seedMsg);
+    size_t len = strlen(e.mml);
+    char* msg = (char*)malloc(len + 16);
+    if (msg) {
+        snprintf(msg, len + 16, "gen:done:%s", e.mml);
+        client->text(msg);
+        free(msg);
+    }
+    Serial.printf("[GPT] Pool: serving seed %u to #%u\n", e.seed, client->id());
+}
+
+// Worker wait before an idle refill
+static const TickType_t genIdleWait = pdMS_TO_TICKS(GPT_POOL_IDLE_MS);
+#else
+static const TickType_t genIdleWait = portMAX_DELAY;
+#endif
+
+#if GPT_BATCH_DECODE
+// Decodes up to count requests together, one pass per token for all of
+// them, each at its own temperature
+static void runBatch(GenRequest** reqs, int count) {
+    GPTBatchItem items[GPT_SESSIONS];
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (!startRequest(&gptSessions[n], reqs[i])) continue;
+        items[n] = { &gptSessions[n], "MML@", reqs[i]->temperature, reqs[i], &reqs[i]->cancel, nullptr };
+        n++;
+    }
+    if (n == 0) return;
+    gpt_generate_batch(items, n, 900, streamCallback);
+    for (int i = 0; i < n; i++) {
+        finishRequest(items[i].session, (GenRequest*)items[i].user_data, items[i].output);
+    }
+}
+
+// Single worker on core 0: takes every queued request that has a free
+// session and decodes them as one batch
+void genWorker(void* param) {
+    int sessions = (int)(intptr_t)param;
+    for (;;) {
+        GenRequest* reqs[GPT_SESSIONS];
+        int count = 0;
+        if (xQueueReceive(genRequestQueue, &reqs[0], genIdleWait) != pdTRUE) {
+#if GPT_POOL_SIZE
+            poolRefill(&gptSessions[0]);
+#endif
+            continue;
+        }
+        count = 1;
+        while (count < sessions && xQueueReceive(genRequestQueue, &reqs[count], 0) == pdTRUE) count++;
+
+        int live = 0;
+        for (int i = 0; i < count; i++) {
+            if (reqs[i]->cancel) {
+                queueWsMessage("gen:err:aborted", reqs[i]->client);
+                genRelease(reqs[i]);
+            } else {
+                reqs[live++] = reqs[i];
+            }
+        }
+        // A lone request keeps speculative decoding
+        if (live == 1) runRequest(&gptSessions[0], reqs[0]);
+        else if (live > 1) runBatch(reqs, live);
+        for (int i = 0; i < live; i++) genRelease(reqs[i]);
+    }
+}
+#else
+// One per session, on core 0: runs requests in arrival order
+void genWorker(void* param) {
+    GPTSession* session = (GPTSession*)param;
+    for (;;) {
+        GenRequest* req = nullptr;
+        // The first session's worker also keeps the pool filled
+        if (xQueueReceive(genRequestQueue, &req, session == &gptSessions[0] ? genIdleWait : portMAX_DELAY) != pdTRUE) {
+#if GPT_POOL_SIZE
+            if (session == &gptSessions[0]) poolRefill(session);
+#endif
+            continue;
+        }
+        if (req->cancel) {
+            queueWsMessage("gen:err:aborted", req->client);
+        } else {
+            runRequest(session, req);
+        }
+        genRelease(req);
+    }
+}
+#endif
+
+// Loads the model on core 0 while setup() brings up WiFi, the song
+// catalog and the server; clients see status:gpt:1 once it is ready.
+// Graceful — firmware works without it. Prefers running in place from
+// the flash partition, falling back to LittleFS.
+void gptLoadTask(void* param) {
+    bool ok = gpt_load_partition(&gptModel, GPT_MODEL_PARTITION);
+    if (!ok) {
+        if (!LittleFS.begin(true)) {
+            Serial.println("[GPT] LittleFS mount failed");
+        } else {
+            ok = gpt_load(&gptModel, "/model.bin");
+        }
+    }
+    bool w8a8 = GPT_W8A8;
+    if (ok && w8a8 && !gpt_simd_check()) {
+        Serial.printf("[GPT] ERROR: %s dot_i8_i8 disagrees with reference — W8A8 off\n", gpt_simd_name());
+        w8a8 = false;
+    }
+    // Sessions past the first are optional: run with as many as fit
+    int sessions = 0;
+    while (ok && sessions < GPT_SESSIONS &&
+           gpt_session_init(&gptSessions[sessions], &gptModel, GPT_KV_STORAGE)) {
+        GPTSession& session = gptSessions[sessions++];
+        session.speculative = GPT_SPEC_MODE;
+        session.draft_layers = GPT_DRAFT_LAYERS;
+        session.w8a8 = w8a8;
+    }
+    if (ok && sessions == 0) {
+        gpt_free(&gptModel);
+        ok = false;
+    }
+    if (ok) {
+#if GPT_DUAL_CORE
+        gpt_parallel_start(1);
+#endif
+#if GPT_PREFIX_PERSIST
+        if (LittleFS.begin(true)) gpt_prefix_load(&gptSessions[0], GPT_PREFIX_FILE);
+#endif
+#if GPT_POOL_SIZE && GPT_POOL_PERSIST
+        if (LittleFS.begin(true)) poolLoad();
+#endif
+        if (GPT_SPEC_MODE == GPT_SPEC_NGRAM) {
+            // Draft speculative tokens from the built-in MML songs
+            static const char* draftTexts[SONG_DEF_COUNT];
+            int draftCount = 0;
+            for (uint16_t i = 0; i < SONG_DEF_COUNT; i++) {
+                if (songDefs[i].fmt == FMT_MML) draftTexts[draftCount++] = songDefs[i].str;
+            }
+            if (!gpt_draft_build(&gptModel, draftTexts, draftCount)) {
+                Serial.println("[GPT] Draft index unavailable — drafting from history only");
+            }
+        }
+#if GPT_BATCH_DECODE
+        xTaskCreatePinnedToCore(genWorker, "gpt_gen", 8192, (void*)(intptr_t)sessions, 1, nullptr, 0);
+#else
+        for (int i = 0; i < sessions; i++) {
+            xTaskCreatePinnedToCore(genWorker, "gpt_gen", 8192, &gptSessions[i], 1, nullptr, 0);
+        }
+#endif
+        gptLoaded = true;
+        queueWsMessage("status:gpt:1");
+        // Internal RAM is what WiFi and the web server still have to work with
+        Serial.printf("[GPT] Model loaded at %lums with %d session(s)! internal=%u, psram=%u\n",
+            millis(), sessions, (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+            (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    } else {
+        Serial.println("[GPT] Model not found or failed — continuing without GPT");
+    }
     vTaskDelete(NULL);
 }
 
@@ -979,6 +1111,9 @@ background:var(--border);border-radius:2px;outline:none}
 .slider-row input[type=range]::-webkit-slider-thumb{-webkit-appearance:none;width:20px;height:20px;
 border-radius:50%;background:var(--accent2);cursor:pointer}
 .val{min-width:28px;text-align:right;font-variant-numeric:tabular-nums}
+.seed-row{margin-top:12px}
+.seed-row input[type=text]{flex:1;padding:8px;border:1px solid var(--border);border-radius:6px;
+background:var(--card);color:var(--text);font-family:monospace;-webkit-user-select:text;user-select:text}
 .output{background:var(--card);border:1px solid var(--border);border-radius:8px;padding:16px;
 font-family:monospace;font-size:0.8rem;color:var(--accent2);min-height:120px;max-height:50vh;
 overflow-y:auto;white-space:pre-wrap;word-break:break-all;display:none;margin-bottom:16px}
@@ -998,6 +1133,10 @@ overflow-y:auto;white-space:pre-wrap;word-break:break-all;display:none;margin-bo
 <input type="range" id="temp" min="1" max="15" value="8" step="1">
 <span class="val" id="tempVal">0.8</span>
 </div>
+<div class="slider-row seed-row">
+<span>Seed</span>
+<input type="text" id="seed" inputmode="numeric" placeholder="random">
+</div>
 </div>
 <div class="output" id="output"></div>
 <div class="status" id="status"></div>
@@ -1009,6 +1148,8 @@ var cancelBtn=document.getElementById('cancelBtn');
 var output=document.getElementById('output');
 var temp=document.getElementById('temp');
 var tempVal=document.getElementById('tempVal');
+var seed=document.getElementById('seed');
+var lastSeed='';
 var status=document.getElementById('status');
 var SERVER=window.location.hostname;
 
@@ -1025,13 +1166,20 @@ function connect(){
       cancelBtn.style.display='';
       output.textContent='';output.style.display='block';
       status.textContent='';
+    } else if(e.data.startsWith('gen:queued:')){
+      genBtn.disabled=true;genBtn.textContent='Queued...';
+      cancelBtn.style.display='';
+      status.textContent='Waiting for '+e.data.substring(11)+' ahead';
+    } else if(e.data.startsWith('gen:seed:')){
+      lastSeed=e.data.substring(9);
     } else if(e.data.startsWith('gen:t:')){
       output.textContent+=e.data.substring(6);
       output.scrollTop=output.scrollHeight;
     } else if(e.data.startsWith('gen:done:')){
+      output.textContent=e.data.substring(9);output.style.display='block';
       genBtn.disabled=false;genBtn.textContent='Generate';
       cancelBtn.style.display='none';
-      status.textContent='Now playing generated melody';
+      status.textContent='Now playing generated melody'+(lastSeed?' (seed '+lastSeed+')':'');
     } else if(e.data.startsWith('gen:err:')){
       genBtn.disabled=false;genBtn.textContent='Generate';
       cancelBtn.style.display='none';
@@ -1042,11 +1190,17 @@ function connect(){
       status.textContent='Now Playing: '+e.data.substring(8);
     } else if(e.data==='stopped'){
       status.textContent='';
+    } else if(e.data==='status:gpt:0'){
+      genBtn.disabled=true;status.textContent='Model not loaded yet';
+    } else if(e.data==='status:gpt:1'){
+      genBtn.disabled=false;
+      if(status.textContent==='Model not loaded yet')status.textContent='';
     }
   };
 }
 genBtn.addEventListener('click',function(){
-  if(sock&&sock.readyState===1)sock.send('gen');
+  var s=seed.value.trim();
+  if(sock&&sock.readyState===1)sock.send(/^[1-9][0-9]{0,9}$/.test(s)?'gen:seed:'+s:'gen');
 });
 cancelBtn.addEventListener('click',function(){
   if(sock&&sock.readyState===1)sock.send('gen:stop');
@@ -1131,6 +1285,7 @@ void onWsEvent(AsyncWebSocket* server, AsyncWebSocketClient* client,
         break;
     case WS_EVT_DISCONNECT:
         Serial.printf("[WS] Client #%u disconnected\n", client->id());
+        genCancel(client->id());
         break;
     case WS_EVT_DATA: {
         AwsFrameInfo* info = (AwsFrameInfo*)arg;
@@ -1162,15 +1317,40 @@ void onWsEvent(AsyncWebSocket* server, AsyncWebSocketClient* client,
                 char volMsg[8];
                 snprintf(volMsg, sizeof(volMsg), "vol:%d", volumePercent);
                 ws.textAll(volMsg);
-            } else if (len == 3 && memcmp(data, "gen", 3) == 0) {
+            } else if ((len == 3 && memcmp(data, "gen", 3) == 0) ||
+                       (len >= 10 && len <= 19 && memcmp(data, "gen:seed:", 9) == 0)) {
+                uint32_t seed = 0;
+                if (len > 3) {
+                    char numBuf[12];
+                    memcpy(numBuf, data + 9, len - 9);
+                    numBuf[len - 9] = '\0';
+                    seed = strtoul(numBuf, nullptr, 10);
+                }
+                int ahead = 0;
+                GenRequest* req = nullptr;
+#if GPT_POOL_SIZE
+                PoolEntry pooled;
+#endif
                 if (!gptLoaded) {
                     client->text("gen:err:no model");
-                } else if (generating) {
+#if GPT_POOL_SIZE
+                } else if (genPending(client->id())) {
+                    client->text("gen:err:busy");  // Checked before the pool is spent on it
+                } else if (seed == 0 && poolTake(&pooled)) {
+                    poolServe(client, pooled);  // The worker refills once idle
+#endif
+                } else if (!(req = genSubmit(client->id(), seed, genTemperature, &ahead))) {
                     client->text("gen:err:busy");
                 } else {
-                    generating = true;
-                    genAbort = false;
-                    xTaskCreatePinnedToCore(genTask, "gpt_gen", 8192, nullptr, 1, nullptr, 0);
+                    if (ahead >= GPT_SESSIONS) {
+                        char msg[24];
+                        snprintf(msg, sizeof(msg), "gen:queued:%d", ahead - GPT_SESSIONS + 1);
+                        client->text(msg);
+                    }
+                    xQueueSend(genRequestQueue, &req, 0);  // one entry per slot, never full
+#if GPT_POOL_SIZE
+                    poolCancel = true;
+#endif
                 }
             } else if (len >= 9 && memcmp(data, "gen:temp:", 9) == 0) {
                 char tbuf[8];
@@ -1184,8 +1364,8 @@ void onWsEvent(AsyncWebSocket* server, AsyncWebSocketClient* client,
                     Serial.printf("[GPT] Temperature set to %.2f\n", genTemperature);
                 }
             } else if (len == 8 && memcmp(data, "gen:stop", 8) == 0) {
-                genAbort = true;
-                Serial.println("[GPT] Generation abort requested");
+                genCancel(client->id());
+                Serial.printf("[GPT] Generation abort requested by #%u\n", client->id());
             }
         }
         break;
@@ -1220,38 +1400,25 @@ void setup() {
     // Stop button
     pinMode(PIN_STOP_BTN, INPUT_PULLUP);
 
-    // WiFi
+    // Model load runs alongside the rest of boot
+    genRequestQueue = xQueueCreate(GPT_GEN_QUEUE, sizeof(GenRequest*));
+    // Results from every session plus every pooled melody served at once
+    genResultQueue = xQueueCreate(GPT_SESSIONS + GPT_POOL_SIZE, sizeof(char*));
+    wsMessageQueue = xQueueCreate(32, sizeof(WsMessage));
+    xTaskCreatePinnedToCore(gptLoadTask, "gpt_load", 8192, nullptr, 1, nullptr, 0);
+
+    // WiFi (connects in the background; loop() reports it)
     IPAddress ip(BUZZER_IP);
     IPAddress gw(GATEWAY);
     IPAddress sn(SUBNET);
     WiFi.config(ip, gw, sn);
     WiFi.begin(WIFI_SSID, WIFI_PASS);
-    Serial.print("[WIFI] Connecting");
-    while (WiFi.status() != WL_CONNECTED) {
-        delay(500);
-        Serial.print(".");
-    }
-    Serial.printf("\n[WIFI] Connected — IP: %s\n", WiFi.localIP().toString().c_str());
+    Serial.println("[WIFI] Connecting...");
 
     // Parse song definitions (lazy — names + track counts only)
     parseSongDefs();
     Serial.printf("[HEAP] Free after song defs: %u bytes\n", ESP.getFreeHeap());
 
-    // GPT model loading (graceful — firmware works without it)
-    if (!LittleFS.begin(true)) {
-        Serial.println("[GPT] LittleFS mount failed");
-    } else {
-        gptLoaded = gpt_load(&gptModel, "/model.bin");
-        if (gptLoaded) {
-            Serial.printf("[GPT] Model loaded! heap=%u, psram=%u\n",
-                ESP.getFreeHeap(), ESP.getFreePsram());
-        } else {
-            Serial.println("[GPT] Model not found or failed — continuing without GPT");
-        }
-    }
-    genResultQueue = xQueueCreate(1, sizeof(char*));
-    wsMessageQueue = xQueueCreate(32, sizeof(char*));
-
     // WebSocket
     ws.onEvent(onWsEvent);
     server.addHandler(&ws);
@@ -1302,7 +1469,7 @@ void setup() {
     });
 
     server.begin();
-    Serial.printf("[BOOT] Server started — %d songs loaded\n", SONG_COUNT);
+    Serial.printf("[BOOT] Server started at %lums — %d songs loaded\n", millis(), SONG_COUNT);
 }
 
 // ---------- loop ----------
@@ -1332,12 +1499,13 @@ void loop() {
 
     ws.cleanupClients();
 
-    // Drain WebSocket message queue (thread-safe relay from core 0 genTask)
+    // Drain WebSocket message queue (thread-safe relay from the core 0 workers)
     {
-        char* wsMsg = nullptr;
-        while (xQueueReceive(wsMessageQueue, &wsMsg, 0) == pdTRUE && wsMsg) {
-            ws.textAll(wsMsg);
-            free(wsMsg);
+        WsMessage wsMsg;
+        while (xQueueReceive(wsMessageQueue, &wsMsg, 0) == pdTRUE) {
+            if (wsMsg.client) ws.text(wsMsg.client, wsMsg.text);
+            else ws.textAll(wsMsg.text);
+            free(wsMsg.text);
         }
     }
 
@@ -1353,6 +1521,9 @@ void loop() {
         }
     }
 
+    // Keep the GPT helper off this core while it times the buzzers
+    gpt_parallel_set_enabled(!anyPlayerActive());
+
     // Update all players
     for (uint8_t i = 0; i < NUM_BUZZERS; i++) {
         updatePlayer(players[i]);
@@ -1397,6 +1568,17 @@ void loop() {
         }
     }
 
+    // Report (re)connections; setup() doesn't wait for WiFi
+    {
+        static bool wifiUp = false;
+        bool up = WiFi.status() == WL_CONNECTED;
+        if (up && !wifiUp) {
+            Serial.printf("[WIFI] Connected at %lums — IP: %s\n",
+                millis(), WiFi.localIP().toString().c_str());
+        }
+        wifiUp = up;
+    }
+
     // WiFi reconnect
     if (millis() - lastWifiCheck >= WIFI_CHECK_INTERVAL) {
         lastWifiCheck = millis();
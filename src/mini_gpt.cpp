@@ -1,7 +1,11 @@
 #include "mini_gpt.h"
+#include "gpt_kernels.h"
+#include "gpt_simd.h"
+#include "music.h"
 #include <Arduino.h>
 #include <LittleFS.h>
 #include <esp_heap_caps.h>
+#include <esp_partition.h>
 #include <esp_random.h>
 #include <cstring>
 #include <cmath>
@@ -11,245 +15,544 @@ static inline size_t align4(size_t offset) {
     return (offset + 3) & ~3;
 }
 
-// RMS normalization
-static void rmsnorm(float* out, const float* x, const float* gamma, int n) {
-    float ss = 0.0f;
-    for (int i = 0; i < n; i++) {
-        ss += x[i] * x[i];
+// PCG32 step (XSH-RR output, fixed increment)
+static uint32_t rng_next(GPTRng* rng) {
+    uint64_t old = rng->state;
+    rng->state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+// Uniform float in [0, 1) from the top 24 bits (exact in float on any target)
+static float rng_uniform(GPTRng* rng) {
+    return (float)(rng_next(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+void gpt_seed(GPTSession* session, uint32_t seed) {
+    session->rng.state = 0;
+    rng_next(&session->rng);
+    session->rng.state += seed;
+    rng_next(&session->rng);
+}
+
+// Restore min-heap order (smallest logit at the root) below index i
+static void cand_sift_down(GPTCandidate* heap, int n, int i) {
+    for (;;) {
+        int smallest = i;
+        int l = 2 * i + 1, r = l + 1;
+        if (l < n && heap[l].logit < heap[smallest].logit) smallest = l;
+        if (r < n && heap[r].logit < heap[smallest].logit) smallest = r;
+        if (smallest == i) return;
+        GPTCandidate tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
     }
-    ss = ss / n + 1e-5f;
-    ss = 1.0f / sqrtf(ss);
-    for (int i = 0; i < n; i++) {
-        out[i] = x[i] * ss * gamma[i];
+}
+
+// Top-k survivors of logits in cand[0..top_k), selected with a k-entry
+// min-heap (O(V log k), no allocation), with their unnormalized
+// probabilities exp((logit - max) / T). Returns the total weight.
+static float topk_weights(const float* logits, int vocab_size, float inv_temp,
+                          GPTCandidate* cand, int top_k) {
+    // Seed the heap with the first k logits, then replace the root whenever
+    // a larger logit appears
+    for (int i = 0; i < top_k; i++) {
+        cand[i].logit = logits[i];
+        cand[i].id = i;
+    }
+    for (int i = top_k / 2 - 1; i >= 0; i--) {
+        cand_sift_down(cand, top_k, i);
+    }
+    for (int i = top_k; i < vocab_size; i++) {
+        if (logits[i] > cand[0].logit) {
+            cand[0].logit = logits[i];
+            cand[0].id = i;
+            cand_sift_down(cand, top_k, 0);
+        }
     }
+
+    // Softmax over the k survivors only
+    float max_val = cand[0].logit;
+    for (int i = 1; i < top_k; i++) {
+        if (cand[i].logit > max_val) max_val = cand[i].logit;
+    }
+    float sum = 0.0f;
+    for (int i = 0; i < top_k; i++) {
+        cand[i].logit = expf((cand[i].logit - max_val) * inv_temp);
+        sum += cand[i].logit;
+    }
+    return sum;
 }
 
-// INT8 matrix-vector multiply with dequantization
-// out[rows] = weight_int8[rows x cols] @ in[cols], then scale per row
-static void matmul_int8(float* out, const float* in, const int8_t* weight,
-                        const float* scales, int rows, int cols) {
-    for (int r = 0; r < rows; r++) {
-        const int8_t* row_ptr = weight + r * cols;
-        float sum = 0.0f;
+static bool full_vocab(int top_k, int vocab_size) {
+    return top_k <= 0 || top_k >= vocab_size || top_k > GPT_MAX_TOP_K;
+}
 
-        // 4x loop unroll for ESP32-S3 performance
-        int c = 0;
-        for (; c + 3 < cols; c += 4) {
-            sum += (float)row_ptr[c]   * in[c];
-            sum += (float)row_ptr[c+1] * in[c+1];
-            sum += (float)row_ptr[c+2] * in[c+2];
-            sum += (float)row_ptr[c+3] * in[c+3];
+// Sample token from logits with temperature and top-k filtering; only the
+// top-k survivors are exponentiated.
+static int sample_token(const float* logits, int vocab_size, float temperature,
+                        GPTRng* rng, GPTCandidate* cand, int top_k = 40) {
+    float inv_temp = 1.0f / temperature;
+
+    if (full_vocab(top_k, vocab_size)) {
+        // Full-vocabulary sampling: two passes, recomputing exp in the second
+        float max_val = logits[0];
+        for (int i = 1; i < vocab_size; i++) {
+            if (logits[i] > max_val) max_val = logits[i];
         }
-        // Handle remainder
-        for (; c < cols; c++) {
-            sum += (float)row_ptr[c] * in[c];
+        float sum = 0.0f;
+        for (int i = 0; i < vocab_size; i++) {
+            sum += expf((logits[i] - max_val) * inv_temp);
+        }
+        float target = rng_uniform(rng) * sum;
+        float cumsum = 0.0f;
+        for (int i = 0; i < vocab_size; i++) {
+            cumsum += expf((logits[i] - max_val) * inv_temp);
+            if (cumsum > target) return i;
         }
+        return vocab_size - 1;
+    }
 
-        out[r] = sum * scales[r];
+    float sum = topk_weights(logits, vocab_size, inv_temp, cand, top_k);
+
+    // Random sample from the seeded stream
+    float target = rng_uniform(rng) * sum;
+    float cumsum = 0.0f;
+    for (int i = 0; i < top_k; i++) {
+        cumsum += cand[i].logit;
+        if (cumsum > target) return cand[i].id;
     }
+    return cand[top_k - 1].id;
 }
 
-// Softmax
-static void softmax(float* x, int n) {
-    float max_val = x[0];
-    for (int i = 1; i < n; i++) {
-        if (x[i] > max_val) max_val = x[i];
+// Sample a draft from the top-k distribution q of logits, leaving q in
+// cand[0..top_k) with each survivor's probability in .logit
+static int sample_draft(const float* logits, int vocab_size, float temperature,
+                        GPTRng* rng, GPTCandidate* cand, int top_k = 40) {
+    float sum = topk_weights(logits, vocab_size, 1.0f / temperature, cand, top_k);
+    for (int i = 0; i < top_k; i++) {
+        cand[i].logit /= sum;
     }
-
-    float sum = 0.0f;
-    for (int i = 0; i < n; i++) {
-        x[i] = expf(x[i] - max_val);
-        sum += x[i];
+    float target = rng_uniform(rng);
+    float cumsum = 0.0f;
+    int last = cand[0].id;
+    for (int i = 0; i < top_k; i++) {
+        if (cand[i].logit <= 0.0f) continue;  // masked
+        last = cand[i].id;
+        cumsum += cand[i].logit;
+        if (cumsum > target) return cand[i].id;
     }
+    return last;
+}
 
-    float inv_sum = 1.0f / (sum + 1e-10f);
-    for (int i = 0; i < n; i++) {
-        x[i] *= inv_sum;
+// Probability the proposal gave token id: q from sample_draft, or a point
+// mass on draft when q is null
+static float draft_prob(const GPTCandidate* q, int draft, int id, int top_k = 40) {
+    if (!q) return id == draft ? 1.0f : 0.0f;
+    for (int i = 0; i < top_k; i++) {
+        if (q[i].id == id) return q[i].logit;
     }
+    return 0.0f;
 }
 
-// Sample token from logits with temperature and top-k filtering
-static int sample_token(const float* logits, int vocab_size, float temperature, int top_k = 40) {
-    // Copy and apply temperature
-    float* probs = (float*)malloc(vocab_size * sizeof(float));
-    if (!probs) return 0;
+// Speculative check of a draft token drawn from proposal q against the
+// distribution p that sample_token draws from: keep it with probability
+// min(1, p(draft) / q(draft)), otherwise draw from max(0, p - q)
+// renormalized. The returned token is distributed exactly as
+// sample_token's would be.
+static int sample_verify(const float* logits, int vocab_size, float temperature,
+                         GPTRng* rng, GPTCandidate* cand, int draft, const GPTCandidate* q,
+                         bool* accepted, int top_k = 40) {
+    float inv_temp = 1.0f / temperature;
+    *accepted = true;
+
+    if (full_vocab(top_k, vocab_size)) {
+        float max_val = logits[0];
+        for (int i = 1; i < vocab_size; i++) {
+            if (logits[i] > max_val) max_val = logits[i];
+        }
+        float sum = 0.0f;
+        for (int i = 0; i < vocab_size; i++) {
+            sum += expf((logits[i] - max_val) * inv_temp);
+        }
+        float w_draft = expf((logits[draft] - max_val) * inv_temp);
+        if (rng_uniform(rng) * sum * draft_prob(q, draft, draft) < w_draft) return draft;
 
-    for (int i = 0; i < vocab_size; i++) {
-        probs[i] = logits[i] / temperature;
+        float rest = 0.0f;
+        for (int i = 0; i < vocab_size; i++) {
+            float r = expf((logits[i] - max_val) * inv_temp) - draft_prob(q, draft, i) * sum;
+            if (r > 0.0f) rest += r;
+        }
+        if (rest <= 0.0f) return draft;
+
+        *accepted = false;
+        float target = rng_uniform(rng) * rest;
+        float cumsum = 0.0f;
+        int last = draft;
+        for (int i = 0; i < vocab_size; i++) {
+            float r = expf((logits[i] - max_val) * inv_temp) - draft_prob(q, draft, i) * sum;
+            if (r <= 0.0f) continue;
+            last = i;
+            cumsum += r;
+            if (cumsum > target) return i;
+        }
+        return last;
     }
 
-    // Apply top-k filtering
-    if (top_k > 0 && top_k < vocab_size) {
-        // Find the top_k-th largest value
-        float* sorted_logits = (float*)malloc(vocab_size * sizeof(float));
-        if (sorted_logits) {
-            memcpy(sorted_logits, probs, vocab_size * sizeof(float));
+    float sum = topk_weights(logits, vocab_size, inv_temp, cand, top_k);
+    float w_draft = 0.0f;
+    for (int i = 0; i < top_k; i++) {
+        if (cand[i].id == draft) w_draft = cand[i].logit;
+    }
+    if (rng_uniform(rng) * sum * draft_prob(q, draft, draft) < w_draft) return draft;
+
+    // Residual weights replace the candidates' own
+    float rest = 0.0f;
+    for (int i = 0; i < top_k; i++) {
+        float r = cand[i].logit - draft_prob(q, draft, cand[i].id) * sum;
+        cand[i].logit = r > 0.0f ? r : 0.0f;
+        rest += cand[i].logit;
+    }
+    if (rest <= 0.0f) return draft;
 
-            // Simple selection: find k-th largest by partial sort
-            for (int i = 0; i < top_k; i++) {
-                for (int j = i + 1; j < vocab_size; j++) {
-                    if (sorted_logits[j] > sorted_logits[i]) {
-                        float tmp = sorted_logits[i];
-                        sorted_logits[i] = sorted_logits[j];
-                        sorted_logits[j] = tmp;
-                    }
-                }
-            }
-            float threshold = sorted_logits[top_k - 1];
-            free(sorted_logits);
+    *accepted = false;
+    float target = rng_uniform(rng) * rest;
+    float cumsum = 0.0f;
+    int last = draft;
+    for (int i = 0; i < top_k; i++) {
+        if (cand[i].logit <= 0.0f) continue;
+        last = cand[i].id;
+        cumsum += cand[i].logit;
+        if (cumsum > target) return cand[i].id;
+    }
+    return last;
+}
 
-            // Zero out logits below threshold
-            for (int i = 0; i < vocab_size; i++) {
-                if (probs[i] < threshold) {
-                    probs[i] = -1e9f;  // Large negative to avoid NaN in softmax
-                }
+// Build the prompt-encoder trie from tokenMap.tokens into tokenMap.trie,
+// which the plan sizes for one node per token character. Tokens are
+// inserted in id order and an existing entry is never replaced, so
+// duplicates resolve to the lowest id.
+static void build_trie(GPTModel* model) {
+    GPTTrieNode* trie = model->tokenMap.trie;
+    trie[0] = { 0, 0, -1, 0 };
+    int count = 1;
+    for (int i = 0; i < model->config.vocab_size; i++) {
+        const char* tok = model->tokenMap.tokens[i];
+        size_t len = strlen(tok);
+        if (len == 0 || len > GPT_TOKEN_MATCH_MAX) continue;
+
+        uint16_t node = 0;
+        for (size_t c = 0; c < len; c++) {
+            uint16_t child = trie[node].child;
+            while (child && trie[child].ch != tok[c]) child = trie[child].sibling;
+            if (!child) {
+                child = (uint16_t)count++;
+                trie[child] = { 0, trie[node].child, -1, tok[c] };
+                trie[node].child = child;
             }
+            node = child;
         }
+        if (trie[node].token < 0) trie[node].token = (int16_t)i;
     }
+    model->tokenMap.trie_nodes = count;
+}
 
-    softmax(probs, vocab_size);
-
-    // Random sample using esp_random()
-    uint32_t r = esp_random();
-    float threshold = (float)r / (float)UINT32_MAX;
+// Walk the trie once per output token, remembering the deepest node that
+// ends a token; linear in the text length
+int gpt_encode(const GPTModel* model, const char* text, int* out, int max_out) {
+    const GPTTrieNode* trie = model->tokenMap.trie;
+    int n = 0;
+    const char* p = text;
+
+    while (*p && n < max_out) {
+        int best_token = -1;
+        int best_len = 0;
+        uint16_t node = trie[0].child;
+        for (int len = 1; p[len - 1]; len++) {
+            while (node && trie[node].ch != p[len - 1]) node = trie[node].sibling;
+            if (!node) break;
+            if (trie[node].token >= 0) {
+                best_token = trie[node].token;
+                best_len = len;
+            }
+            node = trie[node].child;
+        }
 
-    float cumsum = 0.0f;
-    int selected = 0;
-    for (int i = 0; i < vocab_size; i++) {
-        cumsum += probs[i];
-        if (cumsum >= threshold) {
-            selected = i;
-            break;
+        if (best_len > 0) {
+            out[n++] = best_token;
+            p += best_len;
+        } else {
+            // Skip unknown character
+            p++;
         }
     }
+    return n;
+}
+
+// KV cache helper used by the planner (defined with the others below)
+static size_t kv_slot_bytes(const KVCache& cache, const GPTConfig& cfg);
 
-    free(probs);
-    return selected;
+// Drop the model file: the PSRAM copy, or the flash mapping
+static void release_file(GPTModel* model) {
+    if (!model->fileData) return;
+    if (model->fileMapped) spi_flash_munmap(model->fileMap);
+    else heap_caps_free(model->fileData);
+    model->fileData = nullptr;
+    model->fileMapped = false;
 }
 
-// Load model from LittleFS
-bool gpt_load(MiniGPT* model, const char* path) {
-    Serial.printf("[GPT] Loading model from %s\n", path);
+// Point w/s at a [rows x cols] weight matrix and its scales at offset and
+// step past them (layout depends on the quant type, see GPTWeights)
+static void map_matrix(GPTModel* model, size_t& offset, int rows, int cols,
+                       const int8_t** w, const float** s) {
+    *w = (const int8_t*)(model->fileData + offset);
+    if (model->weights.quant_type == 2) {
+        offset += (size_t)rows * cols / 2;
+        *s = (const float*)(model->fileData + offset);
+        offset += (size_t)rows * (cols / model->weights.group_size) * sizeof(uint16_t);
+    } else {
+        offset += (size_t)rows * cols;
+        *s = (const float*)(model->fileData + offset);
+        offset += (size_t)rows * sizeof(float);
+    }
+}
 
-    // Open file
-    if (!LittleFS.begin()) {
-        Serial.println("[GPT] LittleFS mount failed");
+bool gpt_read_header(const uint8_t* data, size_t size, GPTFileInfo* info) {
+    if (size < 32 || memcmp(data, "MGPT", 4) != 0) {
+        Serial.println("[GPT] Invalid magic number");
         return false;
     }
 
-    File f = LittleFS.open(path, "r");
-    if (!f) {
-        Serial.printf("[GPT] Failed to open %s\n", path);
+    uint8_t version = data[4];
+    uint8_t quant_type = data[5];
+    if (version != 1) {
+        Serial.printf("[GPT] Unsupported version: %d\n", version);
         return false;
     }
-
-    model->fileSize = f.size();
-    Serial.printf("[GPT] File size: %u bytes\n", model->fileSize);
-
-    // Allocate in PSRAM
-    model->fileData = (uint8_t*)heap_caps_malloc(model->fileSize, MALLOC_CAP_SPIRAM);
-    if (!model->fileData) {
-        Serial.println("[GPT] PSRAM allocation failed");
-        f.close();
+    if (quant_type != 1 && quant_type != 2) {
+        Serial.printf("[GPT] Expected INT8 or INT4 quantization, got %d\n", quant_type);
         return false;
     }
 
-    // Read entire file
-    size_t bytes_read = f.read(model->fileData, model->fileSize);
-    f.close();
+    // Config (little-endian), then 14 reserved bytes; INT4 files keep the
+    // group size in the first
+    const uint8_t* ptr = data + 6;
+    info->config.n_embd = ptr[0] | (ptr[1] << 8);
+    info->config.n_layer = ptr[2];
+    info->config.n_head = ptr[3];
+    info->config.block_size = ptr[4] | (ptr[5] << 8);
+    info->config.vocab_size = ptr[6] | (ptr[7] << 8);
+    info->config.n_tokens = ptr[8] | (ptr[9] << 8);
+    info->quant_type = quant_type;
+    info->group_size = quant_type == 2 ? ptr[10] : 0;
+
+    if (quant_type == 2) {
+        int group = info->group_size;
+        if (group < 16 || group % 16 || group > GPT_Q4_GROUP_MAX || info->config.n_embd % group) {
+            Serial.printf("[GPT] Unsupported INT4 group size %d\n", group);
+            return false;
+        }
+    }
 
-    if (bytes_read != model->fileSize) {
-        Serial.printf("[GPT] Read failed: %u/%u bytes\n", bytes_read, model->fileSize);
-        heap_caps_free(model->fileData);
+    // Token map: a length byte, then the string, per token
+    size_t offset = 32;
+    info->token_chars = 0;
+    for (int i = 0; i < info->config.vocab_size; i++) {
+        if (offset >= size || offset + 1 + data[offset] > size) {
+            Serial.printf("[GPT] Token map truncated at token %d\n", i);
+            return false;
+        }
+        info->token_chars += data[offset];
+        offset += 1 + data[offset];
+    }
+    info->weights_offset = align4(offset);
+
+    // Trie node ids are 16-bit; the plan reserves one node per character
+    if (1 + info->token_chars > 0xFFFF) {
+        Serial.println("[GPT] Vocabulary too large for the tokenizer trie");
         return false;
     }
+    return true;
+}
 
-    Serial.printf("[GPT] File loaded into PSRAM (%u bytes)\n", model->fileSize);
+// Arena items, in layout order within each arena: the model's, then one
+// session's
+enum PlanSlot {
+    PLAN_LAYERS, PLAN_TOKENS, PLAN_TOKEN_TEXT, PLAN_TRIE,
+    PLAN_X, PLAN_XB, PLAN_Q, PLAN_ATT, PLAN_MLP, PLAN_LOGITS, PLAN_KV,
+    PLAN_XQ, PLAN_XQ_SCALE, PLAN_ATT_TILE, PLAN_CAND, PLAN_ALLOWED,
+    PLAN_X_ROWS, PLAN_XB_ROWS, PLAN_Q_ROWS, PLAN_MLP_ROWS, PLAN_LOGIT_ROWS, PLAN_KV_ROWS,
+    PLAN_XQ_ROWS, PLAN_MASK_ROWS, PLAN_DRAFT_CAND,
+    PLAN_CACHE_K, PLAN_CACHE_V, PLAN_KV_SAVE,
+    PLAN_COUNT
+};
+static_assert(PLAN_COUNT == GPT_PLAN_ITEMS, "GPT_PLAN_ITEMS must match the plan slots");
+
+// KV cache data bytes per buffer before the INT8 scales
+static size_t kv_data_bytes(const GPTConfig& cfg, GPTKVType kv_type) {
+    static const size_t elem_size[] = { sizeof(float), sizeof(uint16_t), sizeof(int8_t) };
+    return align4((size_t)cfg.n_layer * cfg.block_size * cfg.n_embd * elem_size[kv_type]);
+}
 
-    // Parse header (32 bytes)
-    const uint8_t* ptr = model->fileData;
+void gpt_plan_memory(const GPTConfig& cfg, GPTKVType kv_type, size_t token_chars,
+                     GPTMemoryPlan* plan) {
+    // SRAM holds one row of each per-token buffer, what one-token decode
+    // touches. The PSRAM copies are sized for a full prefill chunk, with
+    // logits and grammar masks one row per position of a draft
+    // verification pass.
+    const size_t n_embd = cfg.n_embd, vocab = cfg.vocab_size;
+    const size_t chunk = GPT_PREFILL_CHUNK, rows = GPT_DRAFT_MAX + 1;
+    size_t kv_scales = kv_type == GPT_KV_INT8
+        ? (size_t)cfg.n_layer * cfg.block_size * cfg.n_head * sizeof(float) : 0;
+    KVCache kv = {};
+    kv.type = kv_type;
+
+    static const struct { const char* name; GPTArena arena; bool session; } slots[PLAN_COUNT] = {
+        { "layers",     GPT_ARENA_SRAM,  false }, { "tokens",     GPT_ARENA_SRAM,  false },
+        { "token_text", GPT_ARENA_SRAM,  false }, { "trie",       GPT_ARENA_PSRAM, false },
+        { "x",          GPT_ARENA_SRAM,  true },  { "xb",         GPT_ARENA_SRAM,  true },
+        { "q",          GPT_ARENA_SRAM,  true },  { "att",        GPT_ARENA_SRAM,  true },
+        { "mlp_buf",    GPT_ARENA_SRAM,  true },  { "logits",     GPT_ARENA_SRAM,  true },
+        { "kv",         GPT_ARENA_SRAM,  true },  { "xq",         GPT_ARENA_SRAM,  true },
+        { "xq_scale",   GPT_ARENA_SRAM,  true },  { "att_tile",   GPT_ARENA_SRAM,  true },
+        { "cand",       GPT_ARENA_SRAM,  true },  { "allowed",    GPT_ARENA_SRAM,  true },
+        { "x_rows",     GPT_ARENA_PSRAM, true },  { "xb_rows",    GPT_ARENA_PSRAM, true },
+        { "q_rows",     GPT_ARENA_PSRAM, true },  { "mlp_rows",   GPT_ARENA_PSRAM, true },
+        { "logit_rows", GPT_ARENA_PSRAM, true },  { "kv_rows",    GPT_ARENA_PSRAM, true },
+        { "xq_rows",    GPT_ARENA_PSRAM, true },  { "mask_rows",  GPT_ARENA_PSRAM, true },
+        { "draft_cand", GPT_ARENA_PSRAM, true },  { "cache.k",    GPT_ARENA_PSRAM, true },
+        { "cache.v",    GPT_ARENA_PSRAM, true },  { "kv_save",    GPT_ARENA_PSRAM, true },
+    };
+    size_t bytes[PLAN_COUNT];
+    bytes[PLAN_LAYERS] = cfg.n_layer * sizeof(GPTWeights::Layer);
+    bytes[PLAN_TOKENS] = vocab * sizeof(const char*);
+    bytes[PLAN_TOKEN_TEXT] = token_chars + vocab;
+    bytes[PLAN_TRIE] = (1 + token_chars) * sizeof(GPTTrieNode);
+    bytes[PLAN_X] = n_embd * sizeof(float);
+    bytes[PLAN_XB] = n_embd * sizeof(float);
+    bytes[PLAN_Q] = n_embd * sizeof(float);
+    bytes[PLAN_ATT] = (size_t)cfg.n_head * cfg.block_size * sizeof(float);
+    bytes[PLAN_MLP] = 4 * n_embd * sizeof(float);
+    bytes[PLAN_LOGITS] = vocab * sizeof(float);
+    bytes[PLAN_KV] = 2 * n_embd * sizeof(float);
+    bytes[PLAN_XQ] = 4 * n_embd;
+    bytes[PLAN_XQ_SCALE] = chunk * sizeof(float);
+    bytes[PLAN_ATT_TILE] = GPT_PARALLEL_WORKERS * GPT_ATT_TILE * (n_embd / cfg.n_head) * sizeof(float);
+    bytes[PLAN_CAND] = GPT_MAX_TOP_K * sizeof(GPTCandidate);
+    bytes[PLAN_ALLOWED] = vocab;
+    bytes[PLAN_X_ROWS] = chunk * bytes[PLAN_X];
+    bytes[PLAN_XB_ROWS] = chunk * bytes[PLAN_XB];
+    bytes[PLAN_Q_ROWS] = chunk * bytes[PLAN_Q];
+    bytes[PLAN_MLP_ROWS] = chunk * bytes[PLAN_MLP];
+    bytes[PLAN_LOGIT_ROWS] = rows * bytes[PLAN_LOGITS];
+    bytes[PLAN_KV_ROWS] = chunk * bytes[PLAN_KV];
+    bytes[PLAN_XQ_ROWS] = chunk * bytes[PLAN_XQ];
+    bytes[PLAN_MASK_ROWS] = rows * bytes[PLAN_ALLOWED];
+    bytes[PLAN_DRAFT_CAND] = GPT_DRAFT_MAX * GPT_MAX_TOP_K * sizeof(GPTCandidate);
+    bytes[PLAN_CACHE_K] = kv_data_bytes(cfg, kv_type) + kv_scales;
+    bytes[PLAN_CACHE_V] = bytes[PLAN_CACHE_K];
+    bytes[PLAN_KV_SAVE] = GPT_DRAFT_MAX * kv_slot_bytes(kv, cfg);
+
+    for (int a = 0; a < 2; a++) {
+        plan->model_bytes[a] = 0;
+        plan->session_bytes[a] = 0;
+    }
+    for (int i = 0; i < PLAN_COUNT; i++) {
+        size_t* arenas = slots[i].session ? plan->session_bytes : plan->model_bytes;
+        size_t& end = arenas[slots[i].arena];
+        size_t offset = (end + 15) & ~(size_t)15;
+        plan->items[i] = { slots[i].name, slots[i].arena, slots[i].session, offset, bytes[i] };
+        end = offset + bytes[i];
+    }
+}
 
-    // Check magic "MGPT"
-    if (memcmp(ptr, "MGPT", 4) != 0) {
-        Serial.println("[GPT] Invalid magic number");
-        heap_caps_free(model->fileData);
-        return false;
+void gpt_plan_print(const GPTMemoryPlan& plan) {
+    static const char* arena_names[] = { "SRAM", "PSRAM" };
+    for (int session = 0; session < 2; session++) {
+        const size_t* arenas = session ? plan.session_bytes : plan.model_bytes;
+        for (int a = 0; a < 2; a++) {
+            Serial.printf("[GPT] %s %s arena: %u bytes\n", session ? "Session" : "Model",
+                arena_names[a], (unsigned)arenas[a]);
+            for (const GPTPlanItem& item : plan.items) {
+                if (item.session != (bool)session || item.arena != a) continue;
+                Serial.printf("[GPT]   %-10s @%7u %7u\n", item.name, (unsigned)item.offset, (unsigned)item.bytes);
+            }
+        }
     }
-    ptr += 4;
+}
 
-    uint8_t version = ptr[0];
-    uint8_t quant_type = ptr[1];
-    ptr += 2;
+static void* plan_ptr(uint8_t* const* arena, const GPTMemoryPlan& plan, int slot) {
+    const GPTPlanItem& item = plan.items[slot];
+    return arena[item.arena] + item.offset;
+}
 
-    if (version != 1) {
-        Serial.printf("[GPT] Unsupported version: %d\n", version);
-        heap_caps_free(model->fileData);
-        return false;
+static void free_arenas(uint8_t** arena) {
+    for (int a = 0; a < 2; a++) {
+        if (arena[a]) heap_caps_free(arena[a]);
+        arena[a] = nullptr;
     }
+}
 
-    if (quant_type != 1) {
-        Serial.printf("[GPT] Expected INT8 quantization, got %d\n", quant_type);
-        heap_caps_free(model->fileData);
+// Allocate a pair of arenas sized by the plan. false (nothing held) if
+// either fails.
+static bool alloc_arenas(uint8_t** arena, const size_t* bytes) {
+    arena[GPT_ARENA_SRAM] = (uint8_t*)heap_caps_aligned_alloc(
+        16, bytes[GPT_ARENA_SRAM], MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    arena[GPT_ARENA_PSRAM] = (uint8_t*)heap_caps_aligned_alloc(
+        16, bytes[GPT_ARENA_PSRAM], MALLOC_CAP_SPIRAM);
+    if (arena[GPT_ARENA_SRAM] && arena[GPT_ARENA_PSRAM]) return true;
+    free_arenas(arena);
+    return false;
+}
+
+// Parse the header and token map of model->fileData, point the weights
+// into it and lay out the model's arenas. Releases the file on failure.
+static bool gpt_parse(GPTModel* model) {
+    GPTFileInfo info;
+    if (!gpt_read_header(model->fileData, model->fileSize, &info)) {
+        release_file(model);
         return false;
     }
-
-    // Read config (little-endian)
-    model->config.n_embd = ptr[0] | (ptr[1] << 8);
-    ptr += 2;
-    model->config.n_layer = ptr[0];
-    model->config.n_head = ptr[1];
-    ptr += 2;
-    model->config.block_size = ptr[0] | (ptr[1] << 8);
-    ptr += 2;
-    model->config.vocab_size = ptr[0] | (ptr[1] << 8);
-    ptr += 2;
-    model->config.n_tokens = ptr[0] | (ptr[1] << 8);
-    ptr += 2;
-
-    // Skip reserved bytes (14 bytes)
-    ptr += 14;
+    model->config = info.config;
+    model->weights.quant_type = info.quant_type;
+    model->weights.group_size = info.group_size;
 
     Serial.printf("[GPT] Config: n_embd=%d, n_layer=%d, n_head=%d, block_size=%d, vocab=%d\n",
         model->config.n_embd, model->config.n_layer, model->config.n_head,
         model->config.block_size, model->config.vocab_size);
 
-    // Parse token mapping
-    size_t offset = 32;  // After header
-    model->tokenMap.tokens = (char**)malloc(model->config.vocab_size * sizeof(char*));
-    if (!model->tokenMap.tokens) {
-        Serial.println("[GPT] Token map allocation failed");
-        heap_caps_free(model->fileData);
+    // One allocation per arena; from here on gpt_free undoes everything.
+    // The KV type only affects session items.
+    GPTMemoryPlan plan;
+    gpt_plan_memory(model->config, GPT_KV_F32, info.token_chars, &plan);
+    if (!alloc_arenas(model->arena, plan.model_bytes)) {
+        Serial.println("[GPT] Arena allocation failed");
+        gpt_free(model);
         return false;
     }
+    Serial.printf("[GPT] Model arenas: SRAM %u, PSRAM %u bytes\n",
+        (unsigned)plan.model_bytes[GPT_ARENA_SRAM], (unsigned)plan.model_bytes[GPT_ARENA_PSRAM]);
 
+    // Token strings, NUL-terminated and packed
+    const uint8_t* src = model->fileData + 32;
+    char* text = (char*)plan_ptr(model->arena, plan, PLAN_TOKEN_TEXT);
+    model->tokenMap.tokens = (const char**)plan_ptr(model->arena, plan, PLAN_TOKENS);
     for (int i = 0; i < model->config.vocab_size; i++) {
-        uint8_t len = model->fileData[offset];
-        offset++;
-
-        model->tokenMap.tokens[i] = (char*)malloc(len + 1);
-        if (!model->tokenMap.tokens[i]) {
-            Serial.printf("[GPT] Token %d allocation failed\n", i);
-            // Free previously allocated tokens
-            for (int j = 0; j < i; j++) {
-                free(model->tokenMap.tokens[j]);
-            }
-            free(model->tokenMap.tokens);
-            heap_caps_free(model->fileData);
-            return false;
-        }
-
-        memcpy(model->tokenMap.tokens[i], model->fileData + offset, len);
-        model->tokenMap.tokens[i][len] = '\0';
-        offset += len;
+        uint8_t len = *src++;
+        memcpy(text, src, len);
+        text[len] = '\0';
+        model->tokenMap.tokens[i] = text;
+        text += len + 1;
+        src += len;
     }
 
-    // Align to 4 bytes
-    offset = align4(offset);
-
     Serial.printf("[GPT] Token map parsed (%d tokens), offset now %u\n",
-        model->config.vocab_size, offset);
+        model->config.vocab_size, (unsigned)info.weights_offset);
 
     // Set up weight pointers (zero-copy)
+    size_t offset = info.weights_offset;
     int n_embd = model->config.n_embd;
     int n_layer = model->config.n_layer;
     int vocab_size = model->config.vocab_size;
@@ -263,19 +566,8 @@ bool gpt_load(MiniGPT* model, const char* path) {
     model->weights.pos_emb = (const float*)(model->fileData + offset);
     offset += block_size * n_embd * sizeof(float);
 
-    // Allocate layer array
-    model->weights.layers = (GPTWeights::Layer*)malloc(n_layer * sizeof(GPTWeights::Layer));
-    if (!model->weights.layers) {
-        Serial.println("[GPT] Layer array allocation failed");
-        for (int i = 0; i < model->config.vocab_size; i++) {
-            free(model->tokenMap.tokens[i]);
-        }
-        free(model->tokenMap.tokens);
-        heap_caps_free(model->fileData);
-        return false;
-    }
-
     // Parse each layer
+    model->weights.layers = (GPTWeights::Layer*)plan_ptr(model->arena, plan, PLAN_LAYERS);
     for (int l = 0; l < n_layer; l++) {
         GPTWeights::Layer& layer = model->weights.layers[l];
 
@@ -283,45 +575,19 @@ bool gpt_load(MiniGPT* model, const char* path) {
         layer.norm1_gamma = (const float*)(model->fileData + offset);
         offset += n_embd * sizeof(float);
 
-        // Q weights (int8 + scales)
-        layer.q_w = (const int8_t*)(model->fileData + offset);
-        offset += n_embd * n_embd * sizeof(int8_t);
-        layer.q_s = (const float*)(model->fileData + offset);
-        offset += n_embd * sizeof(float);
-
-        // K weights
-        layer.k_w = (const int8_t*)(model->fileData + offset);
-        offset += n_embd * n_embd * sizeof(int8_t);
-        layer.k_s = (const float*)(model->fileData + offset);
-        offset += n_embd * sizeof(float);
-
-        // V weights
-        layer.v_w = (const int8_t*)(model->fileData + offset);
-        offset += n_embd * n_embd * sizeof(int8_t);
-        layer.v_s = (const float*)(model->fileData + offset);
-        offset += n_embd * sizeof(float);
-
-        // O weights
-        layer.o_w = (const int8_t*)(model->fileData + offset);
-        offset += n_embd * n_embd * sizeof(int8_t);
-        layer.o_s = (const float*)(model->fileData + offset);
-        offset += n_embd * sizeof(float);
+        // Q, K, V, O weights
+        map_matrix(model, offset, n_embd, n_embd, &layer.q_w, &layer.q_s);
+        map_matrix(model, offset, n_embd, n_embd, &layer.k_w, &layer.k_s);
+        map_matrix(model, offset, n_embd, n_embd, &layer.v_w, &layer.v_s);
+        map_matrix(model, offset, n_embd, n_embd, &layer.o_w, &layer.o_s);
 
         // norm2_gamma
         layer.norm2_gamma = (const float*)(model->fileData + offset);
         offset += n_embd * sizeof(float);
 
-        // MLP up
-        layer.mlp_up_w = (const int8_t*)(model->fileData + offset);
-        offset += 4 * n_embd * n_embd * sizeof(int8_t);
-        layer.mlp_up_s = (const float*)(model->fileData + offset);
-        offset += 4 * n_embd * sizeof(float);
-
-        // MLP down
-        layer.mlp_down_w = (const int8_t*)(model->fileData + offset);
-        offset += n_embd * 4 * n_embd * sizeof(int8_t);
-        layer.mlp_down_s = (const float*)(model->fileData + offset);
-        offset += n_embd * sizeof(float);
+        // MLP up and down
+        map_matrix(model, offset, 4 * n_embd, n_embd, &layer.mlp_up_w, &layer.mlp_up_s);
+        map_matrix(model, offset, n_embd, 4 * n_embd, &layer.mlp_down_w, &layer.mlp_down_s);
     }
 
     // Final norm
@@ -329,68 +595,19 @@ bool gpt_load(MiniGPT* model, const char* path) {
     offset += n_embd * sizeof(float);
 
     // LM head
-    model->weights.lm_head_w = (const int8_t*)(model->fileData + offset);
-    offset += vocab_size * n_embd * sizeof(int8_t);
-    model->weights.lm_head_s = (const float*)(model->fileData + offset);
-    offset += vocab_size * sizeof(float);
-
-    Serial.printf("[GPT] Weight pointers set, final offset=%u\n", offset);
-
-    // Allocate KV cache in PSRAM
-    size_t kv_size = n_layer * block_size * n_embd * sizeof(float);
-    model->cache.k = (float*)heap_caps_malloc(kv_size, MALLOC_CAP_SPIRAM);
-    model->cache.v = (float*)heap_caps_malloc(kv_size, MALLOC_CAP_SPIRAM);
-
-    if (!model->cache.k || !model->cache.v) {
-        Serial.println("[GPT] KV cache allocation failed");
-        if (model->cache.k) heap_caps_free(model->cache.k);
-        if (model->cache.v) heap_caps_free(model->cache.v);
-        free(model->weights.layers);
-        for (int i = 0; i < model->config.vocab_size; i++) {
-            free(model->tokenMap.tokens[i]);
-        }
-        free(model->tokenMap.tokens);
-        heap_caps_free(model->fileData);
-        return false;
-    }
+    map_matrix(model, offset, vocab_size, n_embd, &model->weights.lm_head_w, &model->weights.lm_head_s);
 
-    Serial.printf("[GPT] KV cache allocated in PSRAM (%u bytes x 2)\n", kv_size);
-
-    // Allocate activation buffers in internal SRAM (prefer fast memory)
-    model->buffers.x = (float*)heap_caps_malloc(n_embd * sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
-    model->buffers.xb = (float*)heap_caps_malloc(n_embd * sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
-    model->buffers.q = (float*)heap_caps_malloc(n_embd * sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
-    model->buffers.att = (float*)heap_caps_malloc(model->config.n_head * block_size * sizeof(float),
-                                                   MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
-    model->buffers.mlp_buf = (float*)heap_caps_malloc(4 * n_embd * sizeof(float),
-                                                       MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
-    model->buffers.logits = (float*)heap_caps_malloc(vocab_size * sizeof(float),
-                                                      MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
-
-    if (!model->buffers.x || !model->buffers.xb || !model->buffers.q ||
-        !model->buffers.att || !model->buffers.mlp_buf || !model->buffers.logits) {
-        Serial.println("[GPT] Activation buffer allocation failed");
-        // Free everything
-        if (model->buffers.x) heap_caps_free(model->buffers.x);
-        if (model->buffers.xb) heap_caps_free(model->buffers.xb);
-        if (model->buffers.q) heap_caps_free(model->buffers.q);
-        if (model->buffers.att) heap_caps_free(model->buffers.att);
-        if (model->buffers.mlp_buf) heap_caps_free(model->buffers.mlp_buf);
-        if (model->buffers.logits) heap_caps_free(model->buffers.logits);
-        heap_caps_free(model->cache.k);
-        heap_caps_free(model->cache.v);
-        free(model->weights.layers);
-        for (int i = 0; i < model->config.vocab_size; i++) {
-            free(model->tokenMap.tokens[i]);
-        }
-        free(model->tokenMap.tokens);
-        heap_caps_free(model->fileData);
+    Serial.printf("[GPT] Weight pointers set (%s), final offset=%u\n",
+        info.quant_type == 2 ? "int4" : "int8", (unsigned)offset);
+    if (offset > model->fileSize) {
+        Serial.println("[GPT] File too short for its config");
+        gpt_free(model);
         return false;
     }
 
-    Serial.println("[GPT] Activation buffers allocated in internal SRAM");
-
-    model->pos = 0;
+    model->tokenMap.trie = (GPTTrieNode*)plan_ptr(model->arena, plan, PLAN_TRIE);
+    build_trie(model);
+    Serial.printf("[GPT] Tokenizer trie built (%d nodes)\n", model->tokenMap.trie_nodes);
 
     Serial.println("[GPT] Model loaded successfully!");
     Serial.printf("[GPT] Free heap: %u, Free PSRAM: %u\n",
@@ -399,270 +616,1323 @@ bool gpt_load(MiniGPT* model, const char* path) {
     return true;
 }
 
+// Load model from LittleFS
+bool gpt_load(GPTModel* model, const char* path) {
+    Serial.printf("[GPT] Loading model from %s\n", path);
+
+    // Open file
+    if (!LittleFS.begin()) {
+        Serial.println("[GPT] LittleFS mount failed");
+        return false;
+    }
+
+    File f = LittleFS.open(path, "r");
+    if (!f) {
+        Serial.printf("[GPT] Failed to open %s\n", path);
+        return false;
+    }
+
+    model->fileSize = f.size();
+    Serial.printf("[GPT] File size: %u bytes\n", (unsigned)model->fileSize);
+
+    // Allocate in PSRAM, 16-byte aligned so int8 weight rows suit the
+    // vector dot products (matrices start at 16-byte file offsets)
+    model->fileData = (uint8_t*)heap_caps_aligned_alloc(16, model->fileSize, MALLOC_CAP_SPIRAM);
+    if (!model->fileData) {
+        Serial.println("[GPT] PSRAM allocation failed");
+        f.close();
+        return false;
+    }
+    model->fileMapped = false;
+
+    // Read entire file
+    size_t bytes_read = f.read(model->fileData, model->fileSize);
+    f.close();
+
+    if (bytes_read != model->fileSize) {
+        Serial.printf("[GPT] Read failed: %u/%u bytes\n", (unsigned)bytes_read, (unsigned)model->fileSize);
+        release_file(model);
+        return false;
+    }
+
+    Serial.printf("[GPT] File loaded into PSRAM (%u bytes)\n", (unsigned)model->fileSize);
+
+    return gpt_parse(model);
+}
+
+// Map model from a raw flash partition and run it in place
+bool gpt_load_partition(GPTModel* model, const char* label) {
+    Serial.printf("[GPT] Mapping model partition \"%s\"\n", label);
+
+    const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                           ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!part) {
+        Serial.printf("[GPT] No partition \"%s\"\n", label);
+        return false;
+    }
+
+    // The MMU maps the whole partition; the config decides how much is model
+    const void* data;
+    spi_flash_mmap_handle_t handle;
+    if (esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &data, &handle) != ESP_OK) {
+        Serial.println("[GPT] Partition mmap failed");
+        return false;
+    }
+    model->fileData = (uint8_t*)data;
+    model->fileSize = part->size;
+    model->fileMapped = true;
+    model->fileMap = handle;
+    Serial.printf("[GPT] Partition mapped (%u bytes, no copy)\n", (unsigned)model->fileSize);
+
+    return gpt_parse(model);
+}
+
 // Free model
-void gpt_free(MiniGPT* model) {
-    if (model->fileData) {
-        heap_caps_free(model->fileData);
-        model->fileData = nullptr;
+void gpt_free(GPTModel* model) {
+    release_file(model);
+
+    // Token tables and trie live in the arenas
+    free_arenas(model->arena);
+    model->weights.layers = nullptr;
+    model->tokenMap = {};
+    gpt_draft_free(&model->draft);
+
+    Serial.println("[GPT] Model freed");
+}
+
+bool gpt_session_init(GPTSession* session, const GPTModel* model, GPTKVType kv_type) {
+    GPTMemoryPlan plan;
+    gpt_plan_memory(model->config, kv_type, 0, &plan);
+    if (!alloc_arenas(session->arena, plan.session_bytes)) {
+        Serial.println("[GPT] Session arena allocation failed");
+        return false;
+    }
+    session->model = model;
+
+    // KV cache; INT8 scales live at the tail of each buffer
+    size_t kv_data = kv_data_bytes(model->config, kv_type);
+    bool kv_scales = kv_type == GPT_KV_INT8;
+    KVCache& cache = session->cache;
+    cache.type = kv_type;
+    cache.k = plan_ptr(session->arena, plan, PLAN_CACHE_K);
+    cache.v = plan_ptr(session->arena, plan, PLAN_CACHE_V);
+    cache.k_scale = kv_scales ? (float*)((uint8_t*)cache.k + kv_data) : nullptr;
+    cache.v_scale = kv_scales ? (float*)((uint8_t*)cache.v + kv_data) : nullptr;
+
+    // Activation scratch: the shared buffers, then each layout's rows
+    GPTBuffers& buf = session->token_buffers;
+    buf.rows = 1;
+    buf.att = (float*)plan_ptr(session->arena, plan, PLAN_ATT);
+    buf.xq_scale = (float*)plan_ptr(session->arena, plan, PLAN_XQ_SCALE);
+    buf.att_tile = plan_ptr(session->arena, plan, PLAN_ATT_TILE);
+    buf.cand = (GPTCandidate*)plan_ptr(session->arena, plan, PLAN_CAND);
+    buf.draft_cand = (GPTCandidate*)plan_ptr(session->arena, plan, PLAN_DRAFT_CAND);
+    buf.kv_save = (uint8_t*)plan_ptr(session->arena, plan, PLAN_KV_SAVE);
+    GPTBuffers& chunk = session->chunk_buffers;
+    chunk = buf;
+    chunk.rows = GPT_PREFILL_CHUNK;
+
+    buf.x = (float*)plan_ptr(session->arena, plan, PLAN_X);
+    buf.xb = (float*)plan_ptr(session->arena, plan, PLAN_XB);
+    buf.q = (float*)plan_ptr(session->arena, plan, PLAN_Q);
+    buf.mlp_buf = (float*)plan_ptr(session->arena, plan, PLAN_MLP);
+    buf.logits = (float*)plan_ptr(session->arena, plan, PLAN_LOGITS);
+    buf.kv = (float*)plan_ptr(session->arena, plan, PLAN_KV);
+    buf.xq = (int8_t*)plan_ptr(session->arena, plan, PLAN_XQ);
+    buf.allowed = (uint8_t*)plan_ptr(session->arena, plan, PLAN_ALLOWED);
+
+    chunk.x = (float*)plan_ptr(session->arena, plan, PLAN_X_ROWS);
+    chunk.xb = (float*)plan_ptr(session->arena, plan, PLAN_XB_ROWS);
+    chunk.q = (float*)plan_ptr(session->arena, plan, PLAN_Q_ROWS);
+    chunk.mlp_buf = (float*)plan_ptr(session->arena, plan, PLAN_MLP_ROWS);
+    chunk.logits = (float*)plan_ptr(session->arena, plan, PLAN_LOGIT_ROWS);
+    chunk.kv = (float*)plan_ptr(session->arena, plan, PLAN_KV_ROWS);
+    chunk.xq = (int8_t*)plan_ptr(session->arena, plan, PLAN_XQ_ROWS);
+    chunk.allowed = (uint8_t*)plan_ptr(session->arena, plan, PLAN_MASK_ROWS);
+    session->buffers = chunk;
+
+    static const char* kv_names[] = { "fp32", "fp16", "int8" };
+    Serial.printf("[GPT] Session allocated (KV cache %s, %u + %u bytes)\n", kv_names[kv_type],
+        (unsigned)plan.session_bytes[GPT_ARENA_SRAM], (unsigned)plan.session_bytes[GPT_ARENA_PSRAM]);
+
+    session->pos = 0;
+    session->grammar = true;
+    session->speculative = GPT_SPEC_OFF;
+    session->draft_layers = 2;
+    session->w8a8 = false;
+    session->draft = {};
+    session->prefix_cache = true;
+    session->prefix = {};
+    gpt_seed(session, esp_random());
+    return true;
+}
+
+void gpt_session_free(GPTSession* session) {
+    gpt_prefix_clear(session);
+    free_arenas(session->arena);
+    session->cache = {};
+    session->buffers = {};
+    session->token_buffers = {};
+    session->chunk_buffers = {};
+    session->model = nullptr;
+}
+
+// KV cache slot for an absolute position. The first block_size positions
+// map 1:1; after that the sink slots stay put and the rest wrap around.
+static inline int kv_slot(const GPTConfig& cfg, int pos) {
+    if (pos < cfg.block_size) return pos;
+    int ring = cfg.block_size - GPT_KV_SINK_TOKENS;
+    return GPT_KV_SINK_TOKENS + (pos - GPT_KV_SINK_TOKENS) % ring;
+}
+
+// Offset of (layer, head, slot) in the head-major cache, in elements
+static inline size_t kv_offset(const GPTConfig& cfg, int l, int h, int slot) {
+    int head_dim = cfg.n_embd / cfg.n_head;
+    return (((size_t)l * cfg.n_head + h) * cfg.block_size + slot) * head_dim;
+}
+
+// Offset of (layer, head, slot) in the INT8 scale arrays
+static inline size_t kv_scale_offset(const GPTConfig& cfg, int l, int h, int slot) {
+    return ((size_t)l * cfg.n_head + h) * cfg.block_size + slot;
+}
+
+// Bytes one slot holds across all layers and heads, K and V (with INT8 scales)
+static size_t kv_slot_bytes(const KVCache& cache, const GPTConfig& cfg) {
+    static const size_t elem_size[] = { sizeof(float), sizeof(uint16_t), sizeof(int8_t) };
+    size_t bytes = (size_t)cfg.n_layer * cfg.n_embd * elem_size[cache.type];
+    if (cache.type == GPT_KV_INT8) bytes += (size_t)cfg.n_layer * cfg.n_head * sizeof(float);
+    return 2 * bytes;
+}
+
+// Copy one slot of every layer/head between the cache and buf (packed in
+// kv_slot_bytes order). Used to undo draft positions that overwrote live
+// ring entries.
+static void kv_slot_copy(KVCache& cache, const GPTConfig& cfg, int slot, uint8_t* buf, bool save) {
+    static const size_t elem_size[] = { sizeof(float), sizeof(uint16_t), sizeof(int8_t) };
+    int head_dim = cfg.n_embd / cfg.n_head;
+    size_t row = head_dim * elem_size[cache.type];
+
+    for (int l = 0; l < cfg.n_layer; l++) {
+        for (int h = 0; h < cfg.n_head; h++) {
+            size_t off = kv_offset(cfg, l, h, slot) * elem_size[cache.type];
+            uint8_t* k = (uint8_t*)cache.k + off;
+            uint8_t* v = (uint8_t*)cache.v + off;
+            if (save) { memcpy(buf, k, row); memcpy(buf + row, v, row); }
+            else      { memcpy(k, buf, row); memcpy(v, buf + row, row); }
+            buf += 2 * row;
+
+            if (cache.type == GPT_KV_INT8) {
+                size_t s_off = kv_scale_offset(cfg, l, h, slot);
+                float* ks = cache.k_scale + s_off;
+                float* vs = cache.v_scale + s_off;
+                if (save) { memcpy(buf, ks, sizeof(float)); memcpy(buf + sizeof(float), vs, sizeof(float)); }
+                else      { memcpy(ks, buf, sizeof(float)); memcpy(vs, buf + sizeof(float), sizeof(float)); }
+                buf += 2 * sizeof(float);
+            }
+        }
+    }
+}
+
+// ---------- prefix snapshots ----------
+
+// Copy K/V of slots [0, n) of every layer/head between the cache and buf,
+// packed per layer and head as K rows, V rows, then (INT8) K and V
+// scales: n * kv_slot_bytes in all
+static void kv_prefix_copy(KVCache& cache, const GPTConfig& cfg, int n, uint8_t* buf, bool save) {
+    static const size_t elem_size[] = { sizeof(float), sizeof(uint16_t), sizeof(int8_t) };
+    int head_dim = cfg.n_embd / cfg.n_head;
+    size_t rows = (size_t)n * head_dim * elem_size[cache.type];
+    size_t scales = (size_t)n * sizeof(float);
+
+    for (int l = 0; l < cfg.n_layer; l++) {
+        for (int h = 0; h < cfg.n_head; h++) {
+            size_t off = kv_offset(cfg, l, h, 0) * elem_size[cache.type];
+            uint8_t* k = (uint8_t*)cache.k + off;
+            uint8_t* v = (uint8_t*)cache.v + off;
+            if (save) { memcpy(buf, k, rows); memcpy(buf + rows, v, rows); }
+            else      { memcpy(k, buf, rows); memcpy(v, buf + rows, rows); }
+            buf += 2 * rows;
+
+            if (cache.type == GPT_KV_INT8) {
+                size_t s_off = kv_scale_offset(cfg, l, h, 0);
+                float* ks = cache.k_scale + s_off;
+                float* vs = cache.v_scale + s_off;
+                if (save) { memcpy(buf, ks, scales); memcpy(buf + scales, vs, scales); }
+                else      { memcpy(ks, buf, scales); memcpy(vs, buf + scales, scales); }
+                buf += 2 * scales;
+            }
+        }
     }
+}
 
-    if (model->tokenMap.tokens) {
-        for (int i = 0; i < model->config.vocab_size; i++) {
-            if (model->tokenMap.tokens[i]) {
-                free(model->tokenMap.tokens[i]);
+static void prefix_drop(GPTPrefixCache& pc, GPTPrefix& e) {
+    heap_caps_free(e.data);
+    pc.bytes -= e.bytes;
+    e = {};
+    pc.dirty = true;
+}
+
+void gpt_prefix_clear(GPTSession* session) {
+    for (GPTPrefix& e : session->prefix.entries) {
+        if (e.n_tokens) prefix_drop(session->prefix, e);
+    }
+}
+
+// A new entry for n tokens, evicting least recently used ones to stay
+// within the limits. nullptr if it can't fit even in an empty cache.
+static GPTPrefix* prefix_alloc(GPTSession* session, int n) {
+    const GPTModel* model = session->model;
+    GPTPrefixCache& pc = session->prefix;
+    size_t logits_at = align4(n * sizeof(uint16_t));
+    size_t kv_at = logits_at + model->config.vocab_size * sizeof(float);
+    size_t bytes = kv_at + n * kv_slot_bytes(session->cache, model->config);
+    if (bytes > GPT_PREFIX_MAX_BYTES) return nullptr;
+
+    for (;;) {
+        GPTPrefix* slot = nullptr;
+        GPTPrefix* lru = nullptr;
+        for (GPTPrefix& e : pc.entries) {
+            if (!e.n_tokens) {
+                if (!slot) slot = &e;
+            } else if (!lru || e.last_used < lru->last_used) {
+                lru = &e;
             }
         }
-        free(model->tokenMap.tokens);
-        model->tokenMap.tokens = nullptr;
+        uint8_t* data = nullptr;
+        if (slot && pc.bytes + bytes <= GPT_PREFIX_MAX_BYTES) {
+            data = (uint8_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+        }
+        if (data) {
+            slot->data = data;
+            slot->tokens = (uint16_t*)data;
+            slot->logits = (float*)(data + logits_at);
+            slot->kv = data + kv_at;
+            slot->bytes = bytes;
+            slot->n_tokens = n;
+            slot->last_used = ++pc.clock;
+            pc.bytes += bytes;
+            pc.dirty = true;
+            return slot;
+        }
+        if (!lru) return nullptr;
+        prefix_drop(pc, *lru);
     }
+}
 
-    if (model->weights.layers) {
-        free(model->weights.layers);
-        model->weights.layers = nullptr;
+// Resume a prompt of n tokens from the longest snapshot it starts with
+// that was taken in the session's W8A8 mode: restores the snapshot's K/V and sets session->pos past the tokens that
+// need no prefill, which is returned. A snapshot of the whole prompt also
+// restores logits row 0, under the same mask the prefill would apply
+// (allowed, or nullptr when unconstrained); masked logits can't serve an
+// unconstrained prompt, so its last token is then run again.
+static int prefix_restore(GPTSession* session, const int* tokens, int n, const uint8_t* allowed) {
+    const GPTModel* model = session->model;
+    GPTPrefixCache& pc = session->prefix;
+    GPTPrefix* best = nullptr;
+    for (GPTPrefix& e : pc.entries) {
+        if (!e.n_tokens || e.n_tokens > n || e.w8a8 != session->w8a8 ||
+            (best && e.n_tokens <= best->n_tokens)) continue;
+        int i = 0;
+        while (i < e.n_tokens && e.tokens[i] == tokens[i]) i++;
+        if (i == e.n_tokens) best = &e;
+    }
+    if (!best) {
+        pc.misses++;
+        return 0;
     }
+    pc.hits++;
+    best->last_used = ++pc.clock;
+
+    kv_prefix_copy(session->cache, model->config, best->n_tokens, best->kv, false);
+    int resume = best->n_tokens;
+    if (resume == n) {
+        if (allowed || !best->masked) {
+            int vocab_size = model->config.vocab_size;
+            float* logits = session->buffers.logits;
+            memcpy(logits, best->logits, vocab_size * sizeof(float));
+            if (allowed) {
+                for (int i = 0; i < vocab_size; i++) {
+                    if (!allowed[i]) logits[i] = -INFINITY;
+                }
+            }
+        } else {
+            resume--;
+        }
+    }
+    session->pos = resume;
+    return resume;
+}
 
-    if (model->cache.k) {
-        heap_caps_free(model->cache.k);
-        model->cache.k = nullptr;
+// Snapshot a just-prefilled prompt of n tokens, whose last token's logits
+// are in row 0; replaces an older snapshot of the same tokens and mode
+static void prefix_store(GPTSession* session, const int* tokens, int n, bool masked) {
+    const GPTModel* model = session->model;
+    if (n <= 0 || n > model->config.block_size) return;  // the ring has wrapped
+    GPTPrefixCache& pc = session->prefix;
+    for (GPTPrefix& e : pc.entries) {
+        if (e.n_tokens != n || e.w8a8 != session->w8a8) continue;
+        int i = 0;
+        while (i < n && e.tokens[i] == tokens[i]) i++;
+        if (i == n) prefix_drop(pc, e);
     }
 
-    if (model->cache.v) {
-        heap_caps_free(model->cache.v);
-        model->cache.v = nullptr;
+    GPTPrefix* e = prefix_alloc(session, n);
+    if (!e) return;
+    for (int i = 0; i < n; i++) e->tokens[i] = (uint16_t)tokens[i];
+    memcpy(e->logits, session->buffers.logits, model->config.vocab_size * sizeof(float));
+    kv_prefix_copy(session->cache, model->config, n, e->kv, true);
+    e->masked = masked;
+    e->w8a8 = session->w8a8;
+}
+
+// Snapshot files belong to one model file: FNV-1a over all of it
+static uint32_t model_hash(const GPTModel* model) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < model->fileSize; i++) h = (h ^ model->fileData[i]) * 16777619u;
+    return h;
+}
+
+// Snapshot file: "MGPK", version 2, KV type, entry count (u16), model
+// hash (u32), W8A8 flag and 3 pad bytes; then per entry its token count
+// (u16), mask flag, a pad byte and the entry's data block. Only entries
+// in the session's W8A8 mode are written.
+static const uint8_t PREFIX_FILE_VERSION = 2;
+
+bool gpt_prefix_save(GPTSession* session, const char* path) {
+    const GPTModel* model = session->model;
+    GPTPrefixCache& pc = session->prefix;
+    int count = 0;
+    size_t bytes = 0;
+    for (const GPTPrefix& e : pc.entries) {
+        if (!e.n_tokens || e.w8a8 != session->w8a8) continue;
+        count++;
+        bytes += e.bytes;
+    }
+    uint32_t hash = model_hash(model);
+    uint8_t header[16] = { 'M', 'G', 'P', 'K', PREFIX_FILE_VERSION, session->cache.type,
+                           (uint8_t)count, (uint8_t)(count >> 8),
+                           (uint8_t)hash, (uint8_t)(hash >> 8),
+                           (uint8_t)(hash >> 16), (uint8_t)(hash >> 24),
+                           session->w8a8, 0, 0, 0 };
+
+    File f = LittleFS.open(path, "w");
+    if (!f) {
+        Serial.printf("[GPT] Failed to open %s\n", path);
+        return false;
     }
+    bool ok = f.write(header, sizeof(header)) == sizeof(header);
+    for (const GPTPrefix& e : pc.entries) {
+        if (!e.n_tokens || e.w8a8 != session->w8a8 || !ok) continue;
+        uint8_t entry[4] = { (uint8_t)e.n_tokens, (uint8_t)(e.n_tokens >> 8), e.masked, 0 };
+        ok = f.write(entry, sizeof(entry)) == sizeof(entry) && f.write(e.data, e.bytes) == e.bytes;
+    }
+    f.close();
+    if (!ok) {
+        Serial.printf("[GPT] Write failed: %s\n", path);
+        LittleFS.remove(path);
+        return false;
+    }
+    pc.dirty = false;
+    Serial.printf("[GPT] Saved %d prefix snapshots (%u bytes) to %s\n", count, (unsigned)bytes, path);
+    return true;
+}
 
-    if (model->buffers.x) heap_caps_free(model->buffers.x);
-    if (model->buffers.xb) heap_caps_free(model->buffers.xb);
-    if (model->buffers.q) heap_caps_free(model->buffers.q);
-    if (model->buffers.att) heap_caps_free(model->buffers.att);
-    if (model->buffers.mlp_buf) heap_caps_free(model->buffers.mlp_buf);
-    if (model->buffers.logits) heap_caps_free(model->buffers.logits);
+bool gpt_prefix_load(GPTSession* session, const char* path) {
+    const GPTModel* model = session->model;
+    File f = LittleFS.open(path, "r");
+    if (!f) return false;
 
-    Serial.println("[GPT] Model freed");
+    uint8_t header[16];
+    if (f.read(header, sizeof(header)) != sizeof(header) || memcmp(header, "MGPK", 4) != 0 ||
+        header[4] != PREFIX_FILE_VERSION) {
+        Serial.printf("[GPT] %s is not a prefix snapshot file\n", path);
+        f.close();
+        return false;
+    }
+    uint32_t hash = header[8] | (header[9] << 8) | (header[10] << 16) | ((uint32_t)header[11] << 24);
+    if (header[5] != session->cache.type || header[12] != session->w8a8 || hash != model_hash(model)) {
+        Serial.printf("[GPT] %s was saved for another model, KV type or W8A8 mode, ignored\n", path);
+        f.close();
+        return false;
+    }
+
+    gpt_prefix_clear(session);
+    int count = header[6] | (header[7] << 8);
+    int loaded = 0;
+    for (int i = 0; i < count; i++) {
+        uint8_t entry[4];
+        if (f.read(entry, sizeof(entry)) != sizeof(entry)) break;
+        int n = entry[0] | (entry[1] << 8);
+        if (n <= 0 || n > model->config.block_size) break;
+        GPTPrefix* e = prefix_alloc(session, n);
+        if (!e) break;
+        if (f.read(e->data, e->bytes) != e->bytes) {
+            prefix_drop(session->prefix, *e);
+            break;
+        }
+        e->masked = entry[2];
+        e->w8a8 = session->w8a8;
+        loaded++;
+    }
+    f.close();
+    session->prefix.dirty = false;
+    Serial.printf("[GPT] Loaded %d/%d prefix snapshots from %s\n", loaded, count, path);
+    return loaded == count;
 }
 
-// Forward pass for single token
-static void gpt_forward_token(MiniGPT* model, int token_id) {
-    GPTConfig& cfg = model->config;
-    GPTWeights& w = model->weights;
-    KVCache& cache = model->cache;
-    GPTBuffers& buf = model->buffers;
+// Scatter the current token's K/V (fp32, [n_embd] each) into the cache at
+// the given layer and slot, one head_dim row per head
+static void kv_commit(KVCache& cache, const GPTConfig& cfg, int l, int slot,
+                      const float* k, const float* v) {
+    int head_dim = cfg.n_embd / cfg.n_head;
+
+    for (int h = 0; h < cfg.n_head; h++) {
+        size_t off = kv_offset(cfg, l, h, slot);
+        const float* k_h = k + h * head_dim;
+        const float* v_h = v + h * head_dim;
+
+        switch (cache.type) {
+        case GPT_KV_F32:
+            memcpy((float*)cache.k + off, k_h, head_dim * sizeof(float));
+            memcpy((float*)cache.v + off, v_h, head_dim * sizeof(float));
+            break;
+        case GPT_KV_F16:
+            kv_store_f16((uint16_t*)cache.k + off, k_h, head_dim);
+            kv_store_f16((uint16_t*)cache.v + off, v_h, head_dim);
+            break;
+        case GPT_KV_INT8: {
+            size_t s_off = kv_scale_offset(cfg, l, h, slot);
+            kv_store_q8((int8_t*)cache.k + off, cache.k_scale + s_off, k_h, head_dim);
+            kv_store_q8((int8_t*)cache.v + off, cache.v_scale + s_off, v_h, head_dim);
+            break;
+        }
+        }
+    }
+}
 
-    int n_embd = cfg.n_embd;
-    int n_layer = cfg.n_layer;
-    int n_head = cfg.n_head;
-    int head_dim = n_embd / n_head;
-    int pos = model->pos;
+// Attention for head h of layer l over slots [0, n_ctx). Each head's K/V
+// is one contiguous stream, staged through the SRAM tile.
+static void kv_attend(const KVCache& cache, const GPTConfig& cfg, int l, int h, int n_ctx,
+                      float* out, const float* q, float* att, void* tile) {
+    int head_dim = cfg.n_embd / cfg.n_head;
+    size_t off = kv_offset(cfg, l, h, 0);
+
+    switch (cache.type) {
+    case GPT_KV_F32:
+        attention_head(out, q, (const float*)cache.k + off, (const float*)cache.v + off,
+                       att, n_ctx - 1, head_dim, head_dim, tile);
+        break;
+    case GPT_KV_F16:
+        attention_head_f16(out, q, (const uint16_t*)cache.k + off, (const uint16_t*)cache.v + off,
+                           att, n_ctx - 1, head_dim, head_dim, tile);
+        break;
+    case GPT_KV_INT8: {
+        size_t s_off = kv_scale_offset(cfg, l, h, 0);
+        attention_head_q8(out, q, (const int8_t*)cache.k + off, cache.k_scale + s_off,
+                          (const int8_t*)cache.v + off, cache.v_scale + s_off,
+                          att, n_ctx - 1, head_dim, head_dim, 1, tile);
+        break;
+    }
+    }
+}
 
-    // Start with token + position embedding
-    const float* tok_emb = w.tok_emb + token_id * n_embd;
-    const float* pos_emb = w.pos_emb + pos * n_embd;
+// Forward-pass jobs for gpt_parallel_run. Each worker takes a share of
+// the output rows (or heads), so the split never changes a result.
+
+// Up to three matmuls over the same n inputs. With in_q set the inputs are
+// taken from its int8 rows instead (W8A8).
+struct MatmulJob {
+    float* out;
+    const float* in;
+    const int8_t* weight;
+    const float* scales;
+    int rows, cols;
+    const int8_t* in_q;
+    const float* in_scales;
+};
+
+struct MatmulJobs {
+    MatmulJob m[3];
+    int count;
+    int n;
+    const GPTWeights* weights;
+};
+
+// Output rows [begin, end) of m for n inputs, in the model's weight format
+static void matmul_rows(const GPTWeights& w, const MatmulJob& m, int n, int begin, int end) {
+    if (w.quant_type == 2) {
+        const uint8_t* packed = (const uint8_t*)m.weight;
+        const uint16_t* scales = (const uint16_t*)m.scales;
+        if (m.in_q) {
+            matmul_q4_w8a8_rows(m.out, m.in_q, m.in_scales, packed, scales, w.group_size,
+                                m.rows, m.cols, n, begin, end);
+        } else {
+            matmul_q4_rows(m.out, m.in, packed, scales, w.group_size, m.rows, m.cols, n, begin, end);
+        }
+    } else if (m.in_q) {
+        matmul_w8a8_rows(m.out, m.in_q, m.in_scales, m.weight, m.scales, m.rows, m.cols, n, begin, end);
+    } else {
+        matmul_int8_rows(m.out, m.in, m.weight, m.scales, m.rows, m.cols, n, begin, end);
+    }
+}
 
-    for (int i = 0; i < n_embd; i++) {
-        buf.x[i] = tok_emb[i] + pos_emb[i];
+static void matmul_part(void* ctx, int part, int parts) {
+    MatmulJobs* jobs = (MatmulJobs*)ctx;
+    for (int j = 0; j < jobs->count; j++) {
+        const MatmulJob& m = jobs->m[j];
+        int begin, end;
+        gpt_parallel_range(m.rows, part, parts, &begin, &end);
+        matmul_rows(*jobs->weights, m, jobs->n, begin, end);
     }
+}
 
-    // Transformer layers
-    for (int l = 0; l < n_layer; l++) {
-        GPTWeights::Layer& layer = w.layers[l];
+static void parallel_matmul(const GPTModel* model, float* out, const float* in, const int8_t* weight,
+                            const float* scales, int rows, int cols, int n,
+                            const int8_t* in_q = nullptr, const float* in_scales = nullptr) {
+    MatmulJobs jobs = { { { out, in, weight, scales, rows, cols, in_q, in_scales } }, 1, n,
+                        &model->weights };
+    gpt_parallel_run(matmul_part, &jobs);
+}
 
-        // RMSNorm
-        rmsnorm(buf.xb, buf.x, layer.norm1_gamma, n_embd);
+// The forward pass in stages. Row i of buffers.x holds the residual stream
+// of one token (i < GPT_PREFILL_CHUNK); the other buffers are scratch for
+// a single stage. Rows are consecutive tokens of one sequence, or the next
+// token of several (gpt_generate_batch); either way each weight matrix is
+// read once per pass.
+struct ForwardPass {
+    const GPTModel* model;
+    GPTBuffers* buf;                       // scratch holding the rows
+    bool w8a8;
+    KVCache* cache[GPT_PREFILL_CHUNK];     // row i's sequence
+    int pos[GPT_PREFILL_CHUNK];            // row i's absolute position
+};
+
+// Switch the session's scratch to the chunk rows (PSRAM) for passes over
+// several rows, or the single SRAM row for one-token decode. Rows, logits
+// and masks do not carry across a switch.
+static void use_rows(GPTSession* session, bool chunk) {
+    session->buffers = chunk ? session->chunk_buffers : session->token_buffers;
+}
 
-        // Q, K, V projections
-        matmul_int8(buf.q, buf.xb, layer.q_w, layer.q_s, n_embd, n_embd);
+// Rows 0.. as the tokens at session->pos onwards
+static ForwardPass session_pass(GPTSession* session) {
+    ForwardPass pass;
+    pass.model = session->model;
+    pass.buf = &session->buffers;
+    pass.w8a8 = session->w8a8;
+    for (int i = 0; i < GPT_PREFILL_CHUNK; i++) {
+        pass.cache[i] = &session->cache;
+        pass.pos[i] = session->pos + i;
+    }
+    return pass;
+}
+
+// Matmul inputs as int8 in W8A8 mode: quantizes n rows of in into
+// buffers.xq and returns it, or nullptr (fp32 inputs) otherwise
+static const int8_t* quantize_input(const ForwardPass& pass, const float* in, int cols, int n) {
+    if (!pass.w8a8) return nullptr;
+    quantize_rows_q8(pass.buf->xq, pass.buf->xq_scale, in, cols, n);
+    return pass.buf->xq;
+}
+
+// Attention heads of one row at layer l; each worker stages K/V through
+// its own tile
+struct AttendJob {
+    const KVCache* cache;
+    const GPTConfig* cfg;
+    GPTBuffers* buf;
+    int l, i, n_ctx;
+};
+
+static void attend_part(void* ctx, int part, int parts) {
+    AttendJob* job = (AttendJob*)ctx;
+    const GPTConfig& cfg = *job->cfg;
+    GPTBuffers& buf = *job->buf;
+    int head_dim = cfg.n_embd / cfg.n_head;
+    void* tile = (float*)buf.att_tile + part * GPT_ATT_TILE * head_dim;
+    float* out = buf.xb + job->i * cfg.n_embd;
+    const float* q = buf.q + job->i * cfg.n_embd;
+
+    int begin, end;
+    gpt_parallel_range(cfg.n_head, part, parts, &begin, &end);
+    for (int h = begin; h < end; h++) {
+        kv_attend(*job->cache, cfg, job->l, h, job->n_ctx, out + h * head_dim,
+                  q + h * head_dim, buf.att + h * cfg.block_size, tile);
+    }
+}
 
-        float* k_cache = cache.k + l * cfg.block_size * n_embd + pos * n_embd;
-        float* v_cache = cache.v + l * cfg.block_size * n_embd + pos * n_embd;
+// LM head rows for one normed row x, skipping masked entries
+struct LogitsJob {
+    const GPTModel* model;
+    const float* x;
+    float* logits;
+    const uint8_t* mask;
+};
+
+static void logits_part(void* ctx, int part, int parts) {
+    LogitsJob* job = (LogitsJob*)ctx;
+    const GPTWeights& w = job->model->weights;
+    int n_embd = job->model->config.n_embd;
+
+    int vocab_size = job->model->config.vocab_size;
+    MatmulJob head = { job->logits, job->x, w.lm_head_w, w.lm_head_s, vocab_size, n_embd, nullptr, nullptr };
+
+    int begin, end;
+    gpt_parallel_range(vocab_size, part, parts, &begin, &end);
+    if (!job->mask) {
+        matmul_rows(w, head, 1, begin, end);
+        return;
+    }
+    // One matmul per run of allowed entries
+    for (int r = begin; r < end; ) {
+        if (!job->mask[r]) {
+            job->logits[r++] = -INFINITY;
+            continue;
+        }
+        int start = r;
+        while (r < end && job->mask[r]) r++;
+        matmul_rows(w, head, 1, start, r);
+    }
+}
 
-        matmul_int8(k_cache, buf.xb, layer.k_w, layer.k_s, n_embd, n_embd);
-        matmul_int8(v_cache, buf.xb, layer.v_w, layer.v_s, n_embd, n_embd);
+// Token + position embedding into rows [first, first + n) of buffers.x.
+// Past the window every new token takes the last learned position: cached
+// K/V keep the position they were computed at, and the newest token is
+// always the window's last.
+static void forward_embed(const ForwardPass& pass, const int* tokens, int first, int n) {
+    const GPTConfig& cfg = pass.model->config;
+    const GPTWeights& w = pass.model->weights;
+    int n_embd = cfg.n_embd;
 
-        // Multi-head attention
-        for (int h = 0; h < n_head; h++) {
-            float* q_head = buf.q + h * head_dim;
-            float* att_head = buf.att + h * cfg.block_size;
+    for (int i = 0; i < n; i++) {
+        int p = pass.pos[first + i];
+        if (p >= cfg.block_size) p = cfg.block_size - 1;
+        const float* tok_emb = w.tok_emb + tokens[i] * n_embd;
+        const float* pos_emb = w.pos_emb + p * n_embd;
+        float* x = pass.buf->x + (first + i) * n_embd;
+        for (int j = 0; j < n_embd; j++) {
+            x[j] = tok_emb[j] + pos_emb[j];
+        }
+    }
+}
 
-            // Compute attention scores for all positions up to current
-            for (int t = 0; t <= pos; t++) {
-                float* k_t = cache.k + l * cfg.block_size * n_embd + t * n_embd + h * head_dim;
+// Layers [l_begin, l_end) over rows [first, first + n). Projections and the
+// MLP run as one batched matmul per weight matrix; attention walks the rows
+// in order, so each token sees its cache plus the earlier rows of its
+// sequence. Returns false if *cancel was raised between layers.
+static bool forward_layers(const ForwardPass& pass, int first, int n, int l_begin, int l_end,
+                           const volatile bool* cancel) {
+    const GPTModel* model = pass.model;
+    const GPTConfig& cfg = model->config;
+    const GPTWeights& w = model->weights;
+    GPTBuffers& buf = *pass.buf;
 
-                float score = 0.0f;
-                for (int d = 0; d < head_dim; d++) {
-                    score += q_head[d] * k_t[d];
-                }
-                score /= sqrtf((float)head_dim);
-                att_head[t] = score;
-            }
+    int n_embd = cfg.n_embd;
+    float* x = buf.x + first * n_embd;
 
-            // Softmax over valid positions
-            softmax(att_head, pos + 1);
+    // K/V for the rows land in scratch before the cache store
+    float* k_cur = buf.kv;
+    float* v_cur = buf.kv + buf.rows * n_embd;
 
-            // Weighted sum of values
-            float* out_head = buf.xb + h * head_dim;
-            for (int d = 0; d < head_dim; d++) {
-                out_head[d] = 0.0f;
-            }
+    // Transformer layers
+    for (int l = l_begin; l < l_end; l++) {
+        if (cancel && *cancel) return false;
 
-            for (int t = 0; t <= pos; t++) {
-                float* v_t = cache.v + l * cfg.block_size * n_embd + t * n_embd + h * head_dim;
-                float att_weight = att_head[t];
+        GPTWeights::Layer& layer = w.layers[l];
 
-                for (int d = 0; d < head_dim; d++) {
-                    out_head[d] += att_weight * v_t[d];
-                }
-            }
+        // RMSNorm
+        for (int i = 0; i < n; i++) {
+            rmsnorm(buf.xb + i * n_embd, x + i * n_embd, layer.norm1_gamma, n_embd);
+        }
+
+        // Q, K, V projections
+        const int8_t* xq = quantize_input(pass, buf.xb, n_embd, n);
+        MatmulJobs qkv = { {
+            { buf.q, buf.xb, layer.q_w, layer.q_s, n_embd, n_embd, xq, buf.xq_scale },
+            { k_cur, buf.xb, layer.k_w, layer.k_s, n_embd, n_embd, xq, buf.xq_scale },
+            { v_cur, buf.xb, layer.v_w, layer.v_s, n_embd, n_embd, xq, buf.xq_scale },
+        }, 3, n, &w };
+        gpt_parallel_run(matmul_part, &qkv);
+
+        // Commit and attend one token at a time: a token's K/V must not
+        // reach the cache before earlier tokens have attended (past the
+        // window it may evict a slot they still see)
+        for (int i = 0; i < n; i++) {
+            KVCache& cache = *pass.cache[first + i];
+            int p = pass.pos[first + i];
+            int n_ctx = p < cfg.block_size ? p + 1 : cfg.block_size;
+            kv_commit(cache, cfg, l, kv_slot(cfg, p), k_cur + i * n_embd, v_cur + i * n_embd);
+
+            // Multi-head attention over every occupied slot (order-independent)
+            AttendJob attend = { &cache, &cfg, &buf, l, i, n_ctx };
+            gpt_parallel_run(attend_part, &attend);
         }
 
         // Output projection
-        matmul_int8(buf.q, buf.xb, layer.o_w, layer.o_s, n_embd, n_embd);
+        xq = quantize_input(pass, buf.xb, n_embd, n);
+        parallel_matmul(model, buf.q, buf.xb, layer.o_w, layer.o_s, n_embd, n_embd, n, xq, buf.xq_scale);
 
         // Residual connection
-        for (int i = 0; i < n_embd; i++) {
-            buf.x[i] += buf.q[i];
+        for (int i = 0; i < n * n_embd; i++) {
+            x[i] += buf.q[i];
         }
 
         // RMSNorm
-        rmsnorm(buf.xb, buf.x, layer.norm2_gamma, n_embd);
+        for (int i = 0; i < n; i++) {
+            rmsnorm(buf.xb + i * n_embd, x + i * n_embd, layer.norm2_gamma, n_embd);
+        }
 
         // MLP: up projection -> ReLU -> down projection
-        matmul_int8(buf.mlp_buf, buf.xb, layer.mlp_up_w, layer.mlp_up_s, 4 * n_embd, n_embd);
+        xq = quantize_input(pass, buf.xb, n_embd, n);
+        parallel_matmul(model, buf.mlp_buf, buf.xb, layer.mlp_up_w, layer.mlp_up_s, 4 * n_embd, n_embd, n,
+                        xq, buf.xq_scale);
 
         // ReLU activation
-        for (int i = 0; i < 4 * n_embd; i++) {
+        for (int i = 0; i < n * 4 * n_embd; i++) {
             if (buf.mlp_buf[i] < 0.0f) buf.mlp_buf[i] = 0.0f;
         }
 
-        matmul_int8(buf.q, buf.mlp_buf, layer.mlp_down_w, layer.mlp_down_s, n_embd, 4 * n_embd);
+        xq = quantize_input(pass, buf.mlp_buf, 4 * n_embd, n);
+        parallel_matmul(model, buf.q, buf.mlp_buf, layer.mlp_down_w, layer.mlp_down_s, n_embd, 4 * n_embd, n,
+                        xq, buf.xq_scale);
 
         // Residual connection
-        for (int i = 0; i < n_embd; i++) {
-            buf.x[i] += buf.q[i];
+        for (int i = 0; i < n * n_embd; i++) {
+            x[i] += buf.q[i];
         }
     }
+    return true;
+}
+
+// Final norm + LM head for row `row` into logits. With an allowed mask
+// the LM head skips masked entries; their logits are -inf.
+static void forward_logits_row(const ForwardPass& pass, int row, float* logits, const uint8_t* allowed) {
+    const GPTModel* model = pass.model;
+    GPTBuffers& buf = *pass.buf;
+    int n_embd = model->config.n_embd;
 
     // Final norm
-    rmsnorm(buf.xb, buf.x, w.final_norm_gamma, n_embd);
+    rmsnorm(buf.xb, buf.x + row * n_embd, model->weights.final_norm_gamma, n_embd);
 
     // LM head
-    matmul_int8(buf.logits, buf.xb, w.lm_head_w, w.lm_head_s, cfg.vocab_size, n_embd);
+    LogitsJob job = { model, buf.xb, logits, allowed };
+    gpt_parallel_run(logits_part, &job);
 }
 
-// Generate text
-char* gpt_generate(MiniGPT* model, const char* prompt, int max_tokens,
-                   float temperature, GPTStreamCallback cb, void* user_data) {
-    Serial.printf("[GPT] Generate: prompt=\"%s\", max_tokens=%d, temp=%.2f\n",
-        prompt, max_tokens, temperature);
+// forward_logits_row for rows [first, first + n) into logits rows 0..n-1,
+// with allowed masks in the same row layout as the logits
+static void forward_logits(const ForwardPass& pass, int first, int n, const uint8_t* allowed) {
+    int vocab_size = pass.model->config.vocab_size;
+    for (int row = 0; row < n; row++) {
+        forward_logits_row(pass, first + row, pass.buf->logits + row * vocab_size,
+                           allowed ? allowed + row * vocab_size : nullptr);
+    }
+}
+
+// Forward pass for n consecutive tokens at positions pos .. pos + n - 1
+// (n <= GPT_PREFILL_CHUNK). Logits are computed for the last n_logits
+// tokens only, one vocab-sized row each in buffers.logits. Returns false
+// if *cancel was raised between layers (the chunk's KV entries are then
+// incomplete). Does not advance session->pos.
+static bool gpt_forward(GPTSession* session, const int* tokens, int n, int n_logits,
+                        const uint8_t* allowed, const volatile bool* cancel) {
+    ForwardPass pass = session_pass(session);
+    forward_embed(pass, tokens, 0, n);
+    if (!forward_layers(pass, 0, n, 0, pass.model->config.n_layer, cancel)) return false;
+    forward_logits(pass, n - n_logits, n_logits, allowed);
+    return true;
+}
+
+// Fill one mask row with the tokens that keep the output valid MML from
+// state g. Returns false if nothing is allowed.
+static bool grammar_mask(const GPTModel* model, const MMLGrammar& g, uint8_t* allowed) {
+    bool can_end = mmlGrammarCanEnd(g);
+    int count = 0;
+    for (int i = 0; i < model->config.vocab_size; i++) {
+        bool ok;
+        if (i == GPT_TOKEN_EOS) {
+            ok = can_end;
+        } else if (i == GPT_TOKEN_PAD || i == GPT_TOKEN_BOS) {
+            ok = false;
+        } else {
+            MMLGrammar next = g;
+            const char* tok = model->tokenMap.tokens[i];
+            ok = tok[0] && mmlGrammarFeed(next, tok);
+        }
+        allowed[i] = ok;
+        count += ok;
+    }
+    return count > 0;
+}
+
+// Repetition penalty over the last REP_WINDOW emitted tokens
+static constexpr int REP_WINDOW = 30;
+static constexpr float REP_PENALTY = 1.2f;
+
+// Tokens the repetition penalty applies to
+struct RepWindow {
+    int recent[REP_WINDOW];
+    int count;
+    int idx;
+};
+
+static void rep_push(RepWindow& rep, int token) {
+    rep.recent[rep.idx] = token;
+    rep.idx = (rep.idx + 1) % REP_WINDOW;
+    if (rep.count < REP_WINDOW) rep.count++;
+}
+
+// Output and sampling history of one gpt_generate call
+struct GenState {
+    String result;
+    int* ctx;                  // prompt + emitted token ids (draft lookup)
+    int ctx_len;
+    RepWindow rep;
+    MMLGrammar grammar;
+    bool constrained;
+    int generated;
+};
+
+static void apply_rep_penalty(float* logits, const RepWindow& rep, int vocab_size) {
+    for (int i = 0; i < rep.count; i++) {
+        int tok = rep.recent[i];
+        if (tok >= 0 && tok < vocab_size) {
+            float* logit = &logits[tok];
+            // Sign-aware penalty: reduce probability regardless of logit sign
+            if (*logit > 0) {
+                *logit /= REP_PENALTY;
+            } else {
+                *logit *= REP_PENALTY;  // Makes negative logits MORE negative
+            }
+        }
+    }
+}
+
+// Append a sampled token to the output and every history. Returns false
+// once it completes the song (';' - only EOS could follow).
+static bool emit_token(const GPTModel* model, GenState& st, int token,
+                       GPTStreamCallback cb, void* user_data) {
+    const char* token_str = model->tokenMap.tokens[token];
+    st.result += token_str;
+
+    // Call streaming callback
+    if (cb) {
+        cb(token_str, user_data);
+    }
 
-    // Reset position
-    model->pos = 0;
+    // Track token for repetition penalty
+    rep_push(st.rep, token);
 
-    // Encode prompt (simple greedy matching for now)
-    int prompt_tokens[128];
-    int prompt_len = 0;
+    st.ctx[st.ctx_len++] = token;
+    st.generated++;
 
-    const char* p = prompt;
-    while (*p && prompt_len < 128) {
-        bool found = false;
+    if (st.constrained) {
+        if (!mmlGrammarFeed(st.grammar, token_str)) {
+            st.constrained = false;
+        } else if (st.grammar.state == MML_G_DONE) {
+            return false;
+        }
+    }
+    return true;
+}
 
-        // Try to match longest token first
-        for (int len = 16; len > 0; len--) {
-            if (p + len > prompt + strlen(prompt)) continue;
+// Grammar masks for a pass over [token, drafts...]: row j follows
+// drafts[0..j). Drafts are cut at the first one the grammar rejects (it
+// could never be accepted) and after one that completes the song. Returns
+// the masks, or nullptr for an unconstrained pass.
+static const uint8_t* pass_masks(GPTSession* session, const GenState& st, const int* drafts,
+                                 int* n_drafts) {
+    const GPTModel* model = session->model;
+    if (!st.constrained) return nullptr;
+    int vocab_size = model->config.vocab_size;
+    MMLGrammar g = st.grammar;
+
+    for (int j = 0; j <= *n_drafts; j++) {
+        uint8_t* row = session->buffers.allowed + j * vocab_size;
+        if (!grammar_mask(model, g, row)) {
+            // Nothing could follow; stop before the draft that led here
+            if (j == 0) return nullptr;
+            *n_drafts = j - 1;
+            break;
+        }
+        if (j == *n_drafts) break;
+        if (!row[drafts[j]] || !mmlGrammarFeed(g, model->tokenMap.tokens[drafts[j]])) {
+            *n_drafts = j;
+            break;
+        }
+        if (g.state == MML_G_DONE) *n_drafts = j + 1;
+    }
+    return session->buffers.allowed;
+}
 
-            for (int i = 0; i < model->config.vocab_size; i++) {
-                if (strncmp(p, model->tokenMap.tokens[i], len) == 0 &&
-                    strlen(model->tokenMap.tokens[i]) == (size_t)len) {
-                    prompt_tokens[prompt_len++] = i;
-                    p += len;
-                    found = true;
+// Early-exit drafts for the pass that starts with pass[0] at pos. Each
+// draft is sampled from the first draft_layers layers plus the final norm
+// and LM head, under the same penalty, mask and top-k as a real token; its
+// distribution goes to draft_cand for verification. Those layers' K/V and
+// rows of buffers.x are what the full pass computes anyway, so the pass
+// resumes from layer draft_layers. Writes up to max_out drafts to pass[1..],
+// stopping at EOS and after one that completes the song, and fills masks
+// like pass_masks. Returns false if *cancel was raised.
+static bool draft_early_exit(GPTSession* session, const GenState& st, int* pass, int max_out,
+                             float temperature, int* n_drafts, const uint8_t** allowed,
+                             const volatile bool* cancel) {
+    const GPTModel* model = session->model;
+    GPTBuffers& buf = session->buffers;
+    int vocab_size = model->config.vocab_size;
+    MMLGrammar g = st.grammar;
+    bool constrained = st.constrained;
+    RepWindow rep = st.rep;
+    bool song_done = false;
+    ForwardPass fwd = session_pass(session);
+
+    *n_drafts = 0;
+    for (int j = 0; ; j++) {
+        // Mask first: a row dropped here must not reach the cache, where
+        // past the window it would evict a slot nothing restores
+        uint8_t* mask = nullptr;
+        if (constrained) {
+            mask = buf.allowed + j * vocab_size;
+            if (!grammar_mask(model, g, mask)) {
+                // Nothing could follow; stop before the draft that led here
+                if (j > 0) {
+                    *n_drafts = j - 1;
                     break;
                 }
+                constrained = false;
+                mask = nullptr;
             }
-
-            if (found) break;
         }
 
-        if (!found) {
-            // Skip unknown character
-            p++;
+        forward_embed(fwd, pass + j, j, 1);
+        if (!forward_layers(fwd, j, 1, 0, session->draft_layers, cancel)) return false;
+        if (j == max_out || song_done) break;
+
+        forward_logits(fwd, j, 1, mask);
+        apply_rep_penalty(buf.logits, rep, vocab_size);
+        int token = sample_draft(buf.logits, vocab_size, temperature, &session->rng,
+                                 buf.draft_cand + j * GPT_MAX_TOP_K);
+        if (token == GPT_TOKEN_EOS || token == GPT_TOKEN_PAD) break;
+        if (constrained) {
+            mmlGrammarFeed(g, model->tokenMap.tokens[token]);  // masked, so it parses
+            song_done = g.state == MML_G_DONE;
         }
+        rep_push(rep, token);
+        pass[j + 1] = token;
+        *n_drafts = j + 1;
+    }
+    *allowed = constrained ? buf.allowed : nullptr;
+    return true;
+}
+
+// Start a fresh sequence: encode the prompt into st and prefill it,
+// resuming from the longest prefix snapshot, so logits row 0 holds the
+// first token's distribution. Returns false if the token history can't be
+// allocated; *cancelled is set when *cancel stopped the prefill.
+static bool generate_begin(GPTSession* session, const char* prompt, int max_tokens,
+                           GenState& st, const volatile bool* cancel, bool* cancelled) {
+    const GPTModel* model = session->model;
+
+    // Reset position; the prefill runs in the chunk rows
+    session->pos = 0;
+    session->draft = {};
+    use_rows(session, true);
+
+    // Token history: the prompt, then every emitted token. A prompt token
+    // covers at least one character, so strlen bounds the prompt's share.
+    size_t prompt_chars = strlen(prompt);
+    st.ctx = (int*)malloc((prompt_chars + max_tokens + 1) * sizeof(int));
+    if (!st.ctx) {
+        Serial.println("[GPT] ERROR: Failed to allocate token history");
+        return false;
     }
+    int prompt_len = gpt_encode(model, prompt, st.ctx, (int)prompt_chars);
+    st.ctx_len = prompt_len;
 
     Serial.printf("[GPT] Prompt encoded: %d tokens\n", prompt_len);
 
-    // Process prompt tokens (no sampling)
-    for (int i = 0; i < prompt_len; i++) {
-        gpt_forward_token(model, prompt_tokens[i]);
-        model->pos++;
-    }
-
-    // Generate new tokens (start with prompt in result)
-    String result = prompt;
-    int tokens_generated = 0;
-
-    // Repetition penalty tracking
-    static constexpr int REP_WINDOW = 30;
-    static constexpr float REP_PENALTY = 1.2f;
-    int recent_tokens[REP_WINDOW];
-    int recent_count = 0;
-    int recent_idx = 0;
-
-    while (tokens_generated < max_tokens && model->pos < model->config.block_size - 1) {
-        // Apply repetition penalty
-        for (int i = 0; i < recent_count; i++) {
-            int tok = recent_tokens[i];
-            if (tok >= 0 && tok < model->config.vocab_size) {
-                float* logit = &model->buffers.logits[tok];
-                // Sign-aware penalty: reduce probability regardless of logit sign
-                if (*logit > 0) {
-                    *logit /= REP_PENALTY;
-                } else {
-                    *logit *= REP_PENALTY;  // Makes negative logits MORE negative
-                }
+    // Track MML syntax from the prompt on; a prompt that isn't valid MML
+    // leaves sampling unconstrained
+    mmlGrammarInit(st.grammar);
+    st.constrained = session->grammar && mmlGrammarFeed(st.grammar, prompt);
+    if (session->grammar && !st.constrained) {
+        Serial.println("[GPT] Prompt is not valid MML, grammar constraint off");
+    }
+    int n_drafts = 0;
+    const uint8_t* allowed = pass_masks(session, st, nullptr, &n_drafts);
+
+    // Resume from the longest prefix snapshot, then prefill the rest of
+    // the prompt in chunks (no sampling); only the final chunk needs logits
+    int resume = session->prefix_cache ? prefix_restore(session, st.ctx, prompt_len, allowed) : 0;
+    session->prefix.reused = resume;
+    if (resume > 0) {
+        Serial.printf("[GPT] Resumed %d/%d prompt tokens from a snapshot\n", resume, prompt_len);
+    }
+    *cancelled = false;
+    for (int i = resume; i < prompt_len && !*cancelled; i += GPT_PREFILL_CHUNK) {
+        int n = prompt_len - i < GPT_PREFILL_CHUNK ? prompt_len - i : GPT_PREFILL_CHUNK;
+        *cancelled = !gpt_forward(session, st.ctx + i, n, i + n == prompt_len ? 1 : 0, allowed, cancel);
+        session->pos += n;
+    }
+    if (session->prefix_cache && !*cancelled && resume < prompt_len) {
+        prefix_store(session, st.ctx, prompt_len, allowed != nullptr);
+    }
+    st.result = prompt;
+    return true;
+}
+
+// Log how the sequence ended, drop its history and return its text
+// (caller must free)
+static char* generate_end(GPTSession* session, GenState& st, bool cancelled) {
+    const GPTDraftStats& draft = session->draft;
+    free(st.ctx);
+    st.ctx = nullptr;
+
+    if (cancelled) {
+        Serial.printf("[GPT] Generation cancelled after %d tokens\n", st.generated);
+    } else {
+        Serial.printf("[GPT] Generation complete: %d tokens\n", st.generated);
+    }
+    if (draft.proposed > 0) {
+        Serial.printf("[GPT] Drafts: %u/%u accepted, %u passes\n",
+            draft.accepted, draft.proposed, draft.passes);
+    }
+
+    char* output = (char*)malloc(st.result.length() + 1);
+    if (output) {
+        strcpy(output, st.result.c_str());
+    }
+    return output;
+}
+
+char* gpt_generate(GPTSession* session, const char* prompt, int max_tokens,
+                   float temperature, GPTStreamCallback cb, void* user_data,
+                   const volatile bool* cancel) {
+    const GPTModel* model = session->model;
+    Serial.printf("[GPT] Generate: prompt=\"%s\", max_tokens=%d, temp=%.2f\n",
+        prompt, max_tokens, temperature);
+
+    const GPTConfig& cfg = model->config;
+    GPTBuffers& buf = session->buffers;
+    GPTDraftStats& draft = session->draft;
+    int vocab_size = cfg.vocab_size;
+
+    GenState st = {};
+    bool cancelled;
+    if (!generate_begin(session, prompt, max_tokens, st, cancel, &cancelled)) return nullptr;
+    int n_drafts = 0;
+    const uint8_t* allowed = nullptr;
+
+    // Generate new tokens
+    bool done = false;
+    int next_token = -1;
+    int pass[GPT_DRAFT_MAX + 1];
+    int* drafts = pass + 1;
+    int draft_len = 2;  // grows while drafts hold up, shrinks on rejection
+    bool early_exit = session->speculative == GPT_SPEC_EARLY_EXIT &&
+                      session->draft_layers > 0 && session->draft_layers < cfg.n_layer;
+    size_t slot_bytes = kv_slot_bytes(session->cache, cfg);
+
+    // Each pass runs the last sampled token plus up to GPT_DRAFT_MAX
+    // drafts, which logits rows 1.. then verify
+    while (!cancelled && !done) {
+        int before = st.generated;
+
+        // Walk the rows of the last pass: row j follows drafts[0..j)
+        int accepted = 0;
+        next_token = -1;
+        for (int j = 0; j <= n_drafts && !done; j++) {
+            float* logits = buf.logits + j * vocab_size;
+            apply_rep_penalty(logits, st.rep, vocab_size);
+            if (j == n_drafts) {
+                next_token = sample_token(logits, vocab_size, temperature, &session->rng, buf.cand);
+                break;
+            }
+            bool ok;
+            const GPTCandidate* q = early_exit ? buf.draft_cand + j * GPT_MAX_TOP_K : nullptr;
+            int tok = sample_verify(logits, vocab_size, temperature, &session->rng, buf.cand,
+                                    drafts[j], q, &ok);
+            if (!ok) {
+                next_token = tok;
+                break;
+            }
+            accepted++;
+            done = !emit_token(model, st, drafts[j], cb, user_data);
+        }
+        draft.accepted += accepted;
+        if (n_drafts > 0) {
+            if (accepted == n_drafts) {
+                if (draft_len < GPT_DRAFT_MAX) draft_len++;
+            } else if (draft_len > 1) {
+                draft_len--;
             }
         }
 
-        // Sample next token
-        int next_token = sample_token(model->buffers.logits, model->config.vocab_size, temperature);
+        // Drafts sit at pos .. pos + n_drafts - 1. Put back ring entries
+        // that rejected ones overwrote, then keep the accepted ones.
+        for (int j = accepted; j < n_drafts; j++) {
+            int p = session->pos + j;
+            if (p >= cfg.block_size) {
+                kv_slot_copy(session->cache, cfg, kv_slot(cfg, p), buf.kv_save + j * slot_bytes, false);
+            }
+        }
+        session->pos += accepted;
+        if (done) break;
 
-        // Check for EOS (token 2) or PAD (token 0)
-        if (next_token == 2 || next_token == 0) {
+        // Check for EOS or PAD
+        if (next_token == GPT_TOKEN_EOS || next_token == GPT_TOKEN_PAD) {
             Serial.println("[GPT] EOS/PAD token generated");
             break;
         }
-
-        // Append to result
-        const char* token_str = model->tokenMap.tokens[next_token];
-        result += token_str;
-
-        // Call streaming callback
-        if (cb) {
-            cb(token_str, user_data);
+        if (st.generated >= max_tokens) break;
+        if (!emit_token(model, st, next_token, cb, user_data)) break;
+        if (st.generated >= max_tokens) break;
+
+        // Drafts for the positions after next_token, never past max_tokens
+        int budget = max_tokens - st.generated;
+        if (budget > draft_len) budget = draft_len;
+        pass[0] = next_token;
+        use_rows(session, early_exit || session->speculative == GPT_SPEC_NGRAM);
+        if (!early_exit) {
+            n_drafts = session->speculative == GPT_SPEC_NGRAM
+                ? gpt_draft_propose(&model->draft, st.ctx, st.ctx_len, drafts, budget) : 0;
+            allowed = pass_masks(session, st, drafts, &n_drafts);
         }
 
-        // Track token for repetition penalty
-        recent_tokens[recent_idx] = next_token;
-        recent_idx = (recent_idx + 1) % REP_WINDOW;
-        if (recent_count < REP_WINDOW) recent_count++;
+        // Drafts past the window evict live ring entries; keep a copy.
+        // Early-exit drafts reach the cache as they are made.
+        int to_save = early_exit ? budget : n_drafts;
+        for (int j = 0; j < to_save; j++) {
+            int p = session->pos + 1 + j;
+            if (p >= cfg.block_size) {
+                kv_slot_copy(session->cache, cfg, kv_slot(cfg, p), buf.kv_save + j * slot_bytes, true);
+            }
+        }
 
-        // Forward pass for next token
-        gpt_forward_token(model, next_token);
-        model->pos++;
-        tokens_generated++;
+        // Forward pass for next token and its drafts
+        bool ok;
+        if (early_exit) {
+            ForwardPass fwd = session_pass(session);
+            ok = draft_early_exit(session, st, pass, budget, temperature, &n_drafts, &allowed, cancel) &&
+                 forward_layers(fwd, 0, 1 + n_drafts, session->draft_layers, cfg.n_layer, cancel);
+            if (ok) forward_logits(fwd, 0, 1 + n_drafts, allowed);
+        } else {
+            ok = gpt_forward(session, pass, 1 + n_drafts, 1 + n_drafts, allowed, cancel);
+        }
+        if (!ok) {
+            cancelled = true;
+            break;
+        }
+        session->pos++;
+        draft.passes++;
+        draft.proposed += n_drafts;
 
         // Yield to other tasks every 10 tokens
-        if (tokens_generated % 10 == 0) {
+        if (st.generated / 10 != before / 10) {
             vTaskDelay(1);
         }
     }
+    return generate_end(session, st, cancelled);
+}
 
-    Serial.printf("[GPT] Generation complete: %d tokens\n", tokens_generated);
+bool gpt_generate_batch(GPTBatchItem* items, int count, int max_tokens, GPTStreamCallback cb) {
+    if (count < 1 || count > GPT_BATCH_MAX) return false;
+    const GPTModel* model = items[0].session->model;
+    for (int i = 1; i < count; i++) {
+        if (items[i].session->model != model) return false;
+        if (items[i].session->w8a8 != items[0].session->w8a8) {
+            Serial.println("[GPT] Generate batch: sessions disagree on W8A8");
+            return false;
+        }
+    }
+    const GPTConfig& cfg = model->config;
+    int vocab_size = cfg.vocab_size;
+    Serial.printf("[GPT] Generate batch: %d sequences, max_tokens=%d\n", count, max_tokens);
+
+    // Prefill each prompt on its own session
+    GenState st[GPT_BATCH_MAX];
+    bool live[GPT_BATCH_MAX];
+    bool cancelled[GPT_BATCH_MAX];
+    for (int i = 0; i < count; i++) {
+        st[i] = {};
+        items[i].output = nullptr;
+        live[i] = generate_begin(items[i].session, items[i].prompt, max_tokens, st[i],
+                                 items[i].cancel, &cancelled[i]) && !cancelled[i];
+    }
 
-    // Return allocated string (caller must free)
-    char* output = (char*)malloc(result.length() + 1);
-    if (output) {
-        strcpy(output, result.c_str());
+    // Decode: the first session's chunk rows hold one row per live sequence
+    ForwardPass fwd;
+    fwd.model = model;
+    fwd.buf = &items[0].session->chunk_buffers;
+    fwd.w8a8 = items[0].session->w8a8;
+    int steps = 0;
+    for (;;) {
+        // Sample every live sequence's next token from its logits row 0,
+        // ending it exactly where gpt_generate would
+        int tokens[GPT_BATCH_MAX];
+        int seq[GPT_BATCH_MAX];
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            if (!live[i]) continue;
+            GPTSession* session = items[i].session;
+            if (items[i].cancel && *items[i].cancel) {
+                cancelled[i] = true;
+                live[i] = false;
+                continue;
+            }
+            float* logits = session->buffers.logits;
+            apply_rep_penalty(logits, st[i].rep, vocab_size);
+            int token = sample_token(logits, vocab_size, items[i].temperature, &session->rng,
+                                     session->buffers.cand);
+            if (token == GPT_TOKEN_EOS || token == GPT_TOKEN_PAD || st[i].generated >= max_tokens ||
+                !emit_token(model, st[i], token, cb, items[i].user_data) ||
+                st[i].generated >= max_tokens) {
+                live[i] = false;
+                continue;
+            }
+            tokens[n] = token;
+            seq[n] = i;
+            fwd.cache[n] = &session->cache;
+            fwd.pos[n] = session->pos;
+            n++;
+        }
+        if (n == 0) break;
+
+        // One pass through the layers for all of them; the LM head runs
+        // per row under that sequence's grammar mask
+        forward_embed(fwd, tokens, 0, n);
+        forward_layers(fwd, 0, n, 0, cfg.n_layer, nullptr);
+        for (int r = 0; r < n; r++) {
+            GPTSession* session = items[seq[r]].session;
+            int no_drafts = 0;
+            const uint8_t* allowed = pass_masks(session, st[seq[r]], nullptr, &no_drafts);
+            forward_logits_row(fwd, r, session->buffers.logits, allowed);
+            session->pos++;
+            session->draft.passes++;
+        }
+
+        // Yield to other tasks every 10 steps
+        if (++steps % 10 == 0) {
+            vTaskDelay(1);
+        }
     }
 
-    return output;
+    for (int i = 0; i < count; i++) {
+        if (st[i].ctx) items[i].output = generate_end(items[i].session, st[i], cancelled[i]);
+    }
+    return true;
+}
+
+void gpt_score(GPTSession* session, const int* tokens, int n, float* logits) {
+    const GPTModel* model = session->model;
+    // The logits buffer holds one verification pass worth of rows
+    const int rows = GPT_DRAFT_MAX + 1;
+    int vocab_size = model->config.vocab_size;
+    session->pos = 0;
+    use_rows(session, true);
+    for (int i = 0; i < n; i += rows) {
+        int c = n - i < rows ? n - i : rows;
+        gpt_forward(session, tokens + i, c, c, nullptr, nullptr);
+        memcpy(logits + (size_t)i * vocab_size, session->buffers.logits, (size_t)c * vocab_size * sizeof(float));
+        session->pos += c;
+    }
 }
@@ -0,0 +1,317 @@
+#include "music.h"
+#include <Arduino.h>
+
+// ---------- note frequency helper ----------
+static const uint16_t NOTE_FREQS[12] = { 262,277,294,311,330,349,370,392,415,440,466,494 }; // C4..B4
+
+uint16_t noteFreq(uint8_t semitone, uint8_t octave) {
+    uint16_t f = NOTE_FREQS[semitone % 12];
+    if (octave > 4) f <<= (octave - 4);
+    else if (octave < 4) f >>= (4 - octave);
+    return f;
+}
+
+static uint8_t letterToSemitone(char c) {
+    switch (c) {
+        case 'c': return 0;  case 'd': return 2;  case 'e': return 4;
+        case 'f': return 5;  case 'g': return 7;  case 'a': return 9;
+        case 'b': return 11; default:  return 0;
+    }
+}
+
+// ---------- RTTTL parser ----------
+uint16_t parseRTTTL(const char* rtttl, uint16_t out[][2], uint16_t maxNotes) {
+    const char* p = rtttl;
+    while (*p && *p != ':') p++;
+    if (!*p) return 0;
+    p++;
+
+    uint8_t defDur = 4, defOct = 6;
+    uint16_t bpm = 63;
+    while (*p && *p != ':') {
+        while (*p == ' ' || *p == ',') p++;
+        if (*p == 'd' && *(p+1) == '=') { p += 2; defDur = atoi(p); while (*p >= '0' && *p <= '9') p++; }
+        else if (*p == 'o' && *(p+1) == '=') { p += 2; defOct = atoi(p); while (*p >= '0' && *p <= '9') p++; }
+        else if (*p == 'b' && *(p+1) == '=') { p += 2; bpm = atoi(p); while (*p >= '0' && *p <= '9') p++; }
+        else p++;
+    }
+    if (!*p) return 0;
+    p++;
+
+    if (bpm == 0) bpm = 63;
+    uint16_t count = 0;
+
+    while (*p && count < maxNotes) {
+        while (*p == ' ' || *p == ',') p++;
+        if (!*p) break;
+
+        uint8_t dur = 0;
+        while (*p >= '0' && *p <= '9') { dur = dur * 10 + (*p - '0'); p++; }
+        if (dur == 0) dur = defDur;
+
+        uint16_t freq = 0;
+        if (*p == 'p' || *p == 'P') {
+            p++;
+        } else if ((*p >= 'a' && *p <= 'g') || (*p >= 'A' && *p <= 'G')) {
+            char note = *p | 0x20;
+            p++;
+            uint8_t semi = letterToSemitone(note);
+            if (*p == '#') { semi++; p++; }
+            else if (*p == '_') { semi++; p++; }
+            uint8_t oct = defOct;
+            if (*p >= '0' && *p <= '9') { oct = *p - '0'; p++; }
+            freq = noteFreq(semi, oct);
+        } else {
+            p++; continue;
+        }
+
+        uint32_t divisor = (uint32_t)bpm * dur;
+        uint16_t ms = (uint16_t)((240000UL + divisor / 2) / divisor);
+        if (*p == '.') { ms = (ms * 3 + 1) / 2; p++; }
+
+        out[count][0] = freq;
+        out[count][1] = ms;
+        count++;
+    }
+    return count;
+}
+
+// ---------- MML parser ----------
+uint16_t parseMML(const char* mml, uint16_t out[][2], uint16_t maxNotes, uint8_t track) {
+    const char* p = mml;
+
+    if (p[0]=='M'&&p[1]=='M'&&p[2]=='L'&&p[3]=='@') p += 4;
+
+    const char* end = p;
+    while (*end && *end != ';') end++;
+
+    // Scan Track 0 preamble for initial tempo (applies to all tracks)
+    uint16_t initTempo = 120;
+    {
+        const char* s = p;
+        const char* t0end = s;
+        while (t0end < end && *t0end != ',') t0end++;
+        while (s < t0end) {
+            char c = *s;
+            if ((c >= 'a' && c <= 'g') || (c >= 'A' && c <= 'G') || c == 'r' || c == 'R')
+                break; // stop at first note/rest
+            if (c == 't' || c == 'T') {
+                s++;
+                uint16_t val = 0;
+                while (s < t0end && *s >= '0' && *s <= '9') { val = val*10 + (*s-'0'); s++; }
+                if (val > 0) initTempo = val;
+            } else {
+                s++;
+            }
+        }
+    }
+
+    uint8_t currentTrack = 0;
+    while (currentTrack < track && p < end) {
+        if (*p == ',') { currentTrack++; if (currentTrack == track) { p++; break; } }
+        p++;
+    }
+    if (currentTrack != track) return 0;
+
+    const char* trackEnd = p;
+    while (trackEnd < end && *trackEnd != ',') trackEnd++;
+
+    uint8_t octave = 4;
+    uint8_t defaultLength = 4;
+    uint16_t tempo = initTempo;
+    uint16_t count = 0;
+
+    while (p < trackEnd && count < maxNotes) {
+        char c = *p;
+
+        if (c == 't' || c == 'T') {
+            p++;
+            uint16_t val = 0;
+            while (p < trackEnd && *p >= '0' && *p <= '9') { val = val*10 + (*p-'0'); p++; }
+            if (val > 0) tempo = val;
+            continue;
+        }
+        if (c == 'l' || c == 'L') {
+            p++;
+            uint8_t val = 0;
+            while (p < trackEnd && *p >= '0' && *p <= '9') { val = val*10 + (*p-'0'); p++; }
+            if (val > 0) defaultLength = val;
+            continue;
+        }
+        if (c == 'o' || c == 'O') {
+            p++;
+            uint8_t val = 0;
+            while (p < trackEnd && *p >= '0' && *p <= '9') { val = val*10 + (*p-'0'); p++; }
+            octave = val;
+            continue;
+        }
+        if (c == '>') { octave++; p++; continue; }
+        if (c == '<') { octave--; p++; continue; }
+        if (c == 'v' || c == 'V') {
+            p++;
+            while (p < trackEnd && *p >= '0' && *p <= '9') p++;
+            continue;
+        }
+
+        bool isNote = (c >= 'a' && c <= 'g') || (c >= 'A' && c <= 'G');
+        bool isRest = (c == 'r' || c == 'R');
+
+        if (!isNote && !isRest) { p++; continue; }
+
+        uint16_t freq = 0;
+        if (isNote) {
+            char noteLower = c | 0x20;
+            p++;
+            uint8_t semi = letterToSemitone(noteLower);
+            if (p < trackEnd && (*p == '+' || *p == '#')) { semi++; p++; }
+            else if (p < trackEnd && *p == '-') { semi--; p++; }
+            freq = noteFreq(semi, octave);
+        } else {
+            p++;
+        }
+
+        uint8_t noteLen = 0;
+        while (p < trackEnd && *p >= '0' && *p <= '9') { noteLen = noteLen*10 + (*p-'0'); p++; }
+        if (noteLen == 0) noteLen = defaultLength;
+
+        // Single rounded division to avoid double-truncation drift between tracks
+        uint32_t divisor = (uint32_t)tempo * noteLen;
+        uint32_t ms = (240000UL + divisor / 2) / divisor;
+
+        if (p < trackEnd && *p == '.') { ms = (ms * 3 + 1) / 2; p++; }
+
+        while (p < trackEnd && *p == '&') {
+            p++;
+            if (p < trackEnd && ((*p >= 'a' && *p <= 'g') || (*p >= 'A' && *p <= 'G'))) {
+                p++;
+                if (p < trackEnd && (*p == '+' || *p == '#' || *p == '-')) p++;
+            } else if (p < trackEnd && (*p == 'r' || *p == 'R')) {
+                p++;
+            }
+            uint8_t tieLen = 0;
+            while (p < trackEnd && *p >= '0' && *p <= '9') { tieLen = tieLen*10 + (*p-'0'); p++; }
+            if (tieLen == 0) tieLen = defaultLength;
+            uint32_t tieDivisor = (uint32_t)tempo * tieLen;
+            uint32_t tieMs = (240000UL + tieDivisor / 2) / tieDivisor;
+            if (p < trackEnd && *p == '.') { tieMs = (tieMs * 3 + 1) / 2; p++; }
+            ms += tieMs;
+        }
+
+        if (ms > 65535) ms = 65535;
+        out[count][0] = freq;
+        out[count][1] = (uint16_t)ms;
+        count++;
+    }
+    return count;
+}
+
+uint8_t countMMLTracks(const char* mml) {
+    const char* p = mml;
+    if (p[0]=='M'&&p[1]=='M'&&p[2]=='L'&&p[3]=='@') p += 4;
+
+    const char* end = p;
+    while (*end && *end != ';') end++;
+
+    uint8_t count = 1;
+    while (p < end) {
+        if (*p == ',') count++;
+        p++;
+    }
+    return count;
+}
+
+// ---------- MML grammar tracker ----------
+static const char MML_PREFIX[] = "MML@";
+static const uint8_t MML_MAX_LENGTH_DIGITS = 2;
+
+void mmlGrammarInit(MMLGrammar& g) {
+    g.state = MML_G_PREFIX;
+    g.count = 0;
+    g.limit = 0;
+}
+
+static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+static bool isNoteLetter(char c) { return (c >= 'a' && c <= 'g') || (c >= 'A' && c <= 'G'); }
+static bool isRestLetter(char c) { return c == 'r' || c == 'R'; }
+
+// Start of a new command, as parseMML's main loop sees it
+static bool stepReady(MMLGrammar& g, char c) {
+    char lower = c | 0x20;
+    if (isNoteLetter(c)) { g.state = MML_G_NOTE; return true; }
+    if (isRestLetter(c)) { g.state = MML_G_LENGTH; g.count = 0; return true; }
+    if (lower == 't' || lower == 'l' || lower == 'o' || lower == 'v') {
+        g.state = MML_G_NUMBER;
+        g.count = 0;
+        g.limit = lower == 'o' ? 1 : lower == 'l' ? 2 : 3;
+        return true;
+    }
+    if (c == '<' || c == '>' || c == ',') { g.state = MML_G_READY; return true; }
+    if (c == ';') { g.state = MML_G_DONE; return true; }
+    return false;
+}
+
+bool mmlGrammarStep(MMLGrammar& g, char c) {
+    switch (g.state) {
+    case MML_G_PREFIX:
+        if (c != MML_PREFIX[g.count]) return false;
+        if (++g.count == sizeof(MML_PREFIX) - 1) g.state = MML_G_READY;
+        return true;
+
+    case MML_G_READY:
+        return stepReady(g, c);
+
+    case MML_G_NUMBER:
+        if (isDigit(c)) {
+            if (g.count >= g.limit) return false;
+            g.count++;
+            return true;
+        }
+        // A bare command letter is a no-op to parseMML; require a value
+        if (g.count == 0) return false;
+        return stepReady(g, c);
+
+    case MML_G_NOTE:
+        if (c == '+' || c == '#' || c == '-') { g.state = MML_G_LENGTH; g.count = 0; return true; }
+        [[fallthrough]];  // length, dot, tie or the next command
+    case MML_G_LENGTH:
+        if (isDigit(c)) {
+            if (g.state == MML_G_NOTE) { g.state = MML_G_LENGTH; g.count = 0; }
+            if (g.count >= MML_MAX_LENGTH_DIGITS) return false;
+            g.count++;
+            return true;
+        }
+        if (c == '.') { g.state = MML_G_DOT; return true; }
+        [[fallthrough]];
+    case MML_G_DOT:
+        if (c == '&') { g.state = MML_G_TIE; return true; }
+        return stepReady(g, c);
+
+    case MML_G_TIE:
+        if (isNoteLetter(c)) { g.state = MML_G_NOTE; return true; }
+        if (isRestLetter(c)) { g.state = MML_G_LENGTH; g.count = 0; return true; }
+        if (isDigit(c)) { g.state = MML_G_LENGTH; g.count = 1; return true; }
+        // Bare '&' ties the default length
+        return stepReady(g, c);
+
+    default:  // MML_G_DONE: nothing may follow ';'
+        return false;
+    }
+}
+
+bool mmlGrammarFeed(MMLGrammar& g, const char* s) {
+    for (; *s; s++) {
+        if (!mmlGrammarStep(g, *s)) return false;
+    }
+    return true;
+}
+
+bool mmlGrammarCanEnd(const MMLGrammar& g) {
+    switch (g.state) {
+    case MML_G_PREFIX:
+        return false;
+    case MML_G_NUMBER:
+        return g.count > 0;
+    default:
+        return true;
+    }
+}
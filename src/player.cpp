@@ -0,0 +1,64 @@
+#include "player.h"
+
+// Shared with the audio timer ISR in main.cpp
+volatile BuzzerPWM buzzerPWM[NUM_BUZZERS] = {};
+uint8_t volumePercent = DEFAULT_VOLUME;
+
+// Set up buzzer output for current note (does NOT touch timing)
+void setupNote(MelodyPlayer& p) {
+    uint16_t freq = p.melody[p.noteIndex][0];
+    uint16_t duration = p.melody[p.noteIndex][1];
+    if (freq > 0) {
+        // Apply octave shift via bit shifting (each octave doubles/halves frequency)
+        if (p.octaveShift > 0) freq <<= p.octaveShift;
+        else if (p.octaveShift < 0) freq >>= -p.octaveShift;
+
+        // Clamp to usable range for passive buzzers
+        if (freq < 65) freq = 65;
+        if (freq > 4000) freq = 4000;
+
+        // Software PWM via timer ISR — phase-continuous, no first-cycle glitch
+        buzzerPWM[p.ledcChannel].phase = 0;  // Reset phase for clean note attack
+        buzzerPWM[p.ledcChannel].phaseInc = ((uint64_t)freq << 32) / SAMPLE_RATE_HZ;
+        buzzerPWM[p.ledcChannel].dutyOn = ((uint32_t)volumePercent * 512) / 100;
+        p.gapDuration = duration / 10;
+        if (p.gapDuration < 20) p.gapDuration = 20;
+        if (p.gapDuration >= duration) p.gapDuration = 0;
+    } else {
+        buzzerPWM[p.ledcChannel].phaseInc = 0;
+        p.gapDuration = 0;
+    }
+    p.inGap = false;
+}
+
+void advanceNote(MelodyPlayer& p) {
+    p.noteIndex++;
+    if (p.noteIndex >= p.length) {
+        Serial.printf("[TRACK] Buzzer %d finished (%d notes) at %lums\n",
+            p.ledcChannel, p.length, millis());
+        p.inLoopPause = true;
+        buzzerPWM[p.ledcChannel].dutyOn = 0;  // Silence via duty cycle
+        return;
+    }
+    setupNote(p);
+}
+
+void updatePlayer(MelodyPlayer& p) {
+    if (!p.playing || p.inLoopPause) return;
+    unsigned long elapsed = millis() - p.noteStartedAt;
+    uint16_t duration = p.melody[p.noteIndex][1];
+    uint16_t toneDuration = (p.gapDuration > 0)
+        ? (duration - p.gapDuration) : duration;
+
+    // Silence buzzer when tone portion ends (gap begins)
+    if (!p.inGap && p.gapDuration > 0 && elapsed >= toneDuration) {
+        buzzerPWM[p.ledcChannel].dutyOn = 0;  // Silence via duty cycle
+        p.inGap = true;
+    }
+
+    // Advance to next note when full duration ends (absolute timing)
+    if (elapsed >= duration) {
+        p.noteStartedAt += duration;
+        advanceNote(p);
+    }
+}